@@ -1,20 +1,23 @@
 #pragma once
 
 #include <cstdint>
+#include <type_traits>
 
 namespace audio {
 /**
  * Single frame of audio consisting of left and right channels.
+ *
+ * Plain data laid out like interleaved stereo samples and like the engine's own frames, so that decoders can write into
+ * a mix buffer directly and clear it with `memset`.
  */
 struct AudioFrame {
 	float l;
 	float r;
-
-	AudioFrame();
-	AudioFrame(const float p_l, const float p_r);
-	virtual ~AudioFrame();
 };
 
+static_assert(std::is_trivially_copyable<AudioFrame>::value, "AudioFrame must be trivially copyable");
+static_assert(sizeof(AudioFrame) == 2 * sizeof(float), "AudioFrame must be two packed floats");
+
 /**
  * Abstract class that manages an audio stream.
  */
@@ -47,7 +50,8 @@ public:
 	/**
 	 * Read an arbitrary amount of audio samples from the stream.
 	 *
-	 * Advances the stream's position by the amount of time elapsed.
+	 * Advances the stream's position by the amount of time elapsed. Every frame of the buffer is written, with silence
+	 * where there is no audio.
 	 *
 	 * @param[in] p_buffer Pointer of the array to write into.
 	 * @param[in] p_frames Number of audio frames to read.
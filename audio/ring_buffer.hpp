@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+namespace audio {
+/**
+ * Lock-free ring buffer shared by exactly one producer thread and one consumer thread.
+ *
+ * Read and write positions are absolute and never wrap, so they can also be used to mark points in the stream of
+ * values that went through the buffer.
+ */
+template <typename T>
+class RingBuffer {
+	T *data = nullptr;
+	uint64_t capacity = 0;
+	uint64_t mask = 0;
+
+	std::atomic<uint64_t> read_pos;
+	std::atomic<uint64_t> write_pos;
+
+public:
+	/**
+	 * Allocate storage for at least `p_capacity` values, rounded up to a power of two.
+	 *
+	 * Must not be called while either side is using the buffer.
+	 *
+	 * @param[in] p_capacity Minimum number of values the buffer can hold.
+	 */
+	void resize(const uint64_t p_capacity);
+
+	/**
+	 * @returns The number of values the buffer can hold.
+	 */
+	uint64_t get_capacity() const;
+
+	/**
+	 * @returns The absolute position of the next value to be written.
+	 */
+	uint64_t get_write_pos() const;
+
+	/**
+	 * @returns The number of values that can currently be read. Only meaningful on the consumer thread.
+	 */
+	uint64_t get_available_read() const;
+
+	/**
+	 * @returns The number of values that can currently be written. Only meaningful on the producer thread.
+	 */
+	uint64_t get_available_write() const;
+
+	/**
+	 * Producer only. Copy up to `p_count` values into the buffer.
+	 *
+	 * @param[in] p_values Pointer of the array to copy from.
+	 * @param[in] p_count Number of values to write.
+	 * @returns The number of values written.
+	 */
+	uint64_t write(const T *const p_values, const uint64_t p_count);
+
+	/**
+	 * Consumer only. Copy up to `p_count` values out of the buffer.
+	 *
+	 * @param[in] p_values Pointer of the array to copy into.
+	 * @param[in] p_count Number of values to read.
+	 * @returns The number of values read.
+	 */
+	uint64_t read(T *const p_values, const uint64_t p_count);
+
+	/**
+	 * Consumer only. Discard every value written before the absolute position `p_pos`.
+	 *
+	 * @param[in] p_pos A position previously returned by `get_write_pos`.
+	 */
+	void discard_until(const uint64_t p_pos);
+
+	RingBuffer();
+	~RingBuffer();
+};
+}; // namespace audio
+
+template <typename T>
+void audio::RingBuffer<T>::resize(const uint64_t p_capacity) {
+	uint64_t new_capacity = 1;
+	while (new_capacity < p_capacity) {
+		new_capacity <<= 1;
+	}
+
+	delete[] data;
+	data = new T[new_capacity];
+	capacity = new_capacity;
+	mask = new_capacity - 1;
+
+	read_pos.store(0);
+	write_pos.store(0);
+}
+
+template <typename T>
+uint64_t audio::RingBuffer<T>::get_capacity() const {
+	return capacity;
+}
+
+template <typename T>
+uint64_t audio::RingBuffer<T>::get_write_pos() const {
+	return write_pos.load(std::memory_order_acquire);
+}
+
+template <typename T>
+uint64_t audio::RingBuffer<T>::get_available_read() const {
+	return write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+uint64_t audio::RingBuffer<T>::get_available_write() const {
+	return capacity - (write_pos.load(std::memory_order_relaxed) - read_pos.load(std::memory_order_acquire));
+}
+
+template <typename T>
+uint64_t audio::RingBuffer<T>::write(const T *const p_values, const uint64_t p_count) {
+	const uint64_t pos = write_pos.load(std::memory_order_relaxed);
+	const uint64_t count = std::min(p_count, get_available_write());
+
+	const uint64_t index = pos & mask;
+	const uint64_t first = std::min(count, capacity - index);
+	memcpy(data + index, p_values, first * sizeof(T));
+	memcpy(data, p_values + first, (count - first) * sizeof(T));
+
+	write_pos.store(pos + count, std::memory_order_release);
+	return count;
+}
+
+template <typename T>
+uint64_t audio::RingBuffer<T>::read(T *const p_values, const uint64_t p_count) {
+	const uint64_t pos = read_pos.load(std::memory_order_relaxed);
+	const uint64_t count = std::min(p_count, get_available_read());
+
+	const uint64_t index = pos & mask;
+	const uint64_t first = std::min(count, capacity - index);
+	memcpy(p_values, data + index, first * sizeof(T));
+	memcpy(p_values + first, data, (count - first) * sizeof(T));
+
+	read_pos.store(pos + count, std::memory_order_release);
+	return count;
+}
+
+template <typename T>
+void audio::RingBuffer<T>::discard_until(const uint64_t p_pos) {
+	const uint64_t pos = read_pos.load(std::memory_order_relaxed);
+	if (p_pos > pos) {
+		read_pos.store(std::min(p_pos, write_pos.load(std::memory_order_acquire)), std::memory_order_release);
+	}
+}
+
+template <typename T>
+audio::RingBuffer<T>::RingBuffer() :
+		read_pos(0), write_pos(0) {
+}
+
+template <typename T>
+audio::RingBuffer<T>::~RingBuffer() {
+	delete[] data;
+}
@@ -7,15 +7,9 @@ void AudioStreamPlaybackYT::_bind_methods() {
 }
 
 void AudioStreamPlaybackYT::_mix_internal(AudioFrame *p_buffer, int p_frames) {
-	audio::AudioFrame *buffer = (audio::AudioFrame *)AudioServer::get_singleton()->audio_data_alloc(sizeof(audio::AudioFrame) * p_frames);
-	decoder->sample(buffer, p_frames, active, buffering);
-
-	for (int i = 0; i < p_frames; ++i) {
-		const audio::AudioFrame frame = buffer[i];
-		p_buffer[i] = AudioFrame(frame.l, frame.r);
-	}
-
-	AudioServer::get_singleton()->audio_data_free(buffer);
+	// Both frames are a left and a right float, so the decoder writes into the mix buffer directly.
+	static_assert(sizeof(AudioFrame) == sizeof(audio::AudioFrame), "Frame layouts must match");
+	decoder->sample((audio::AudioFrame *)p_buffer, p_frames, active, buffering);
 
 	const double duration = decoder->get_duration();
 	if (duration > 0.0) {
@@ -35,7 +29,7 @@ void AudioStreamPlaybackYT::start(float p_from_pos) {
 	active = true;
 
 	if (decoder == nullptr) {
-		decoder = new yt::Player(base->get_id());
+		decoder = new yt::Player(base->get_id(), base->prefetch_policy, base->format_policy, base->pcm_cache_policy);
 	}
 
 	seek(p_from_pos);
@@ -82,6 +76,46 @@ AudioStreamPlaybackYT::~AudioStreamPlaybackYT() {
 void AudioStreamYT::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("create", "id"), &AudioStreamYT::create);
 	ClassDB::bind_method(D_METHOD("get_id"), &AudioStreamYT::get_id);
+
+	ClassDB::bind_method(D_METHOD("set_prefetch_mode", "mode"), &AudioStreamYT::set_prefetch_mode);
+	ClassDB::bind_method(D_METHOD("get_prefetch_mode"), &AudioStreamYT::get_prefetch_mode);
+
+	ClassDB::bind_method(D_METHOD("set_prefetch_time", "time"), &AudioStreamYT::set_prefetch_time);
+	ClassDB::bind_method(D_METHOD("get_prefetch_time"), &AudioStreamYT::get_prefetch_time);
+
+	ClassDB::bind_method(D_METHOD("set_prefetch_min_time", "time"), &AudioStreamYT::set_prefetch_min_time);
+	ClassDB::bind_method(D_METHOD("get_prefetch_min_time"), &AudioStreamYT::get_prefetch_min_time);
+
+	ClassDB::bind_method(D_METHOD("set_prefetch_memory_cap", "bytes"), &AudioStreamYT::set_prefetch_memory_cap);
+	ClassDB::bind_method(D_METHOD("get_prefetch_memory_cap"), &AudioStreamYT::get_prefetch_memory_cap);
+
+	ClassDB::bind_method(D_METHOD("set_format_mode", "mode"), &AudioStreamYT::set_format_mode);
+	ClassDB::bind_method(D_METHOD("get_format_mode"), &AudioStreamYT::get_format_mode);
+
+	ClassDB::bind_method(D_METHOD("set_format_max_bitrate", "bitrate"), &AudioStreamYT::set_format_max_bitrate);
+	ClassDB::bind_method(D_METHOD("get_format_max_bitrate"), &AudioStreamYT::get_format_max_bitrate);
+
+	ClassDB::bind_method(D_METHOD("set_pcm_cache_size", "bytes"), &AudioStreamYT::set_pcm_cache_size);
+	ClassDB::bind_method(D_METHOD("get_pcm_cache_size"), &AudioStreamYT::get_pcm_cache_size);
+
+	ClassDB::bind_method(D_METHOD("set_pcm_cache_compact", "compact"), &AudioStreamYT::set_pcm_cache_compact);
+	ClassDB::bind_method(D_METHOD("is_pcm_cache_compact"), &AudioStreamYT::is_pcm_cache_compact);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "prefetch_mode", PROPERTY_HINT_ENUM, "Adaptive,Fixed"), "set_prefetch_mode", "get_prefetch_mode");
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "prefetch_time"), "set_prefetch_time", "get_prefetch_time");
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "prefetch_min_time"), "set_prefetch_min_time", "get_prefetch_min_time");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "prefetch_memory_cap"), "set_prefetch_memory_cap", "get_prefetch_memory_cap");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "format_mode", PROPERTY_HINT_ENUM, "Max Quality,Capped,Adaptive"), "set_format_mode", "get_format_mode");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "format_max_bitrate"), "set_format_max_bitrate", "get_format_max_bitrate");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "pcm_cache_size"), "set_pcm_cache_size", "get_pcm_cache_size");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "pcm_cache_compact"), "set_pcm_cache_compact", "is_pcm_cache_compact");
+
+	BIND_ENUM_CONSTANT(PREFETCH_ADAPTIVE);
+	BIND_ENUM_CONSTANT(PREFETCH_FIXED);
+
+	BIND_ENUM_CONSTANT(FORMAT_MAX_QUALITY);
+	BIND_ENUM_CONSTANT(FORMAT_CAPPED);
+	BIND_ENUM_CONSTANT(FORMAT_ADAPTIVE);
 }
 
 void AudioStreamYT::create(const String &p_id) {
@@ -95,6 +129,70 @@ String AudioStreamYT::get_id() const {
 	return id;
 }
 
+void AudioStreamYT::set_prefetch_mode(const PrefetchMode p_mode) {
+	prefetch_policy.mode = webm::PrefetchPolicy::Mode(p_mode);
+}
+
+AudioStreamYT::PrefetchMode AudioStreamYT::get_prefetch_mode() const {
+	return PrefetchMode(prefetch_policy.mode);
+}
+
+void AudioStreamYT::set_prefetch_time(const double p_time) {
+	prefetch_policy.time = MAX(p_time, 0.0);
+}
+
+double AudioStreamYT::get_prefetch_time() const {
+	return prefetch_policy.time;
+}
+
+void AudioStreamYT::set_prefetch_min_time(const double p_time) {
+	prefetch_policy.min_time = MAX(p_time, 0.0);
+}
+
+double AudioStreamYT::get_prefetch_min_time() const {
+	return prefetch_policy.min_time;
+}
+
+void AudioStreamYT::set_prefetch_memory_cap(const int64_t p_bytes) {
+	prefetch_policy.memory_cap = MAX(p_bytes, (int64_t)0);
+}
+
+int64_t AudioStreamYT::get_prefetch_memory_cap() const {
+	return prefetch_policy.memory_cap;
+}
+
+void AudioStreamYT::set_format_mode(const FormatMode p_mode) {
+	format_policy.mode = yt::FormatPolicy::Mode(p_mode);
+}
+
+AudioStreamYT::FormatMode AudioStreamYT::get_format_mode() const {
+	return FormatMode(format_policy.mode);
+}
+
+void AudioStreamYT::set_format_max_bitrate(const int64_t p_bitrate) {
+	format_policy.max_bitrate = MAX(p_bitrate, (int64_t)0);
+}
+
+int64_t AudioStreamYT::get_format_max_bitrate() const {
+	return format_policy.max_bitrate;
+}
+
+void AudioStreamYT::set_pcm_cache_size(const int64_t p_bytes) {
+	pcm_cache_policy.budget = MAX(p_bytes, (int64_t)0);
+}
+
+int64_t AudioStreamYT::get_pcm_cache_size() const {
+	return pcm_cache_policy.budget;
+}
+
+void AudioStreamYT::set_pcm_cache_compact(const bool p_compact) {
+	pcm_cache_policy.compact = p_compact;
+}
+
+bool AudioStreamYT::is_pcm_cache_compact() const {
+	return pcm_cache_policy.compact;
+}
+
 Ref<AudioStreamPlayback> AudioStreamYT::instance_playback() {
 	Ref<AudioStreamPlaybackYT> playback;
 
@@ -49,9 +49,27 @@ class AudioStreamYT : public AudioStream {
 
 	friend class AudioStreamPlaybackYT;
 
+public:
+	enum PrefetchMode {
+		PREFETCH_ADAPTIVE = webm::PrefetchPolicy::PREFETCH_ADAPTIVE,
+		PREFETCH_FIXED = webm::PrefetchPolicy::PREFETCH_FIXED
+	};
+
+	enum FormatMode {
+		FORMAT_MAX_QUALITY = yt::FormatPolicy::FORMAT_MAX_QUALITY,
+		FORMAT_CAPPED = yt::FormatPolicy::FORMAT_CAPPED,
+		FORMAT_ADAPTIVE = yt::FormatPolicy::FORMAT_ADAPTIVE
+	};
+
+private:
 	String id;
 	double duration = 0.0;
 
+	// Applies to playbacks started after it is changed.
+	webm::PrefetchPolicy prefetch_policy;
+	yt::FormatPolicy format_policy;
+	webm::PcmCachePolicy pcm_cache_policy;
+
 protected:
 	static void _bind_methods();
 
@@ -59,6 +77,45 @@ public:
 	void create(const String &p_id);
 	String get_id() const;
 
+	void set_prefetch_mode(const PrefetchMode p_mode);
+	PrefetchMode get_prefetch_mode() const;
+
+	/**
+	 * Seconds loaded ahead in the fixed mode, and in the adaptive mode until the bandwidth is known.
+	 */
+	void set_prefetch_time(const double p_time);
+	double get_prefetch_time() const;
+
+	void set_prefetch_min_time(const double p_time);
+	double get_prefetch_min_time() const;
+
+	/**
+	 * Bytes the adaptive mode may load ahead of playback.
+	 */
+	void set_prefetch_memory_cap(const int64_t p_bytes);
+	int64_t get_prefetch_memory_cap() const;
+
+	void set_format_mode(const FormatMode p_mode);
+	FormatMode get_format_mode() const;
+
+	/**
+	 * Highest bitrate played in the capped and adaptive modes, in bits per second. Zero for no cap.
+	 */
+	void set_format_max_bitrate(const int64_t p_bitrate);
+	int64_t get_format_max_bitrate() const;
+
+	/**
+	 * Bytes of decoded audio kept to resume from after seeking back. Zero disables it.
+	 */
+	void set_pcm_cache_size(const int64_t p_bytes);
+	int64_t get_pcm_cache_size() const;
+
+	/**
+	 * Keep decoded audio as 16 bit integers, which fits twice as much in the same size.
+	 */
+	void set_pcm_cache_compact(const bool p_compact);
+	bool is_pcm_cache_compact() const;
+
 	virtual Ref<AudioStreamPlayback> instance_playback();
 	virtual String get_stream_name() const;
 
@@ -67,3 +124,6 @@ public:
 	AudioStreamYT();
 	~AudioStreamYT();
 };
+
+VARIANT_ENUM_CAST(AudioStreamYT::PrefetchMode);
+VARIANT_ENUM_CAST(AudioStreamYT::FormatMode);
@@ -0,0 +1,74 @@
+#include "bandwidth_estimator.hpp"
+
+#include <cmath>
+
+void BandwidthEstimator::add_transfer(const uint64_t p_bytes, const uint64_t p_usec) {
+	// A sample covers at least this much downloading time, so that short reads do not skew the estimate.
+	static const uint64_t SAMPLE_USEC = 250000;
+	// Weight of a new sample. Around the last ten samples make up most of the estimate.
+	static const double WEIGHT = 0.2;
+
+	MutexLock lock(mutex);
+
+	pending_bytes += p_bytes;
+	pending_usec += p_usec;
+	if (pending_usec < SAMPLE_USEC) {
+		return;
+	}
+
+	const double sample = pending_bytes * 1000000.0 / pending_usec;
+	pending_bytes = 0;
+	pending_usec = 0;
+
+	if (!has_rate) {
+		has_rate = true;
+		rate = sample;
+		rate_variance = 0.0;
+		return;
+	}
+
+	const double difference = sample - rate;
+	rate += WEIGHT * difference;
+	rate_variance = (1.0 - WEIGHT) * (rate_variance + WEIGHT * difference * difference);
+}
+
+void BandwidthEstimator::add_latency(const uint64_t p_usec) {
+	static const double WEIGHT = 0.2;
+
+	MutexLock lock(mutex);
+
+	const double sample = p_usec / 1000000.0;
+	if (!has_latency) {
+		has_latency = true;
+		latency = sample;
+		return;
+	}
+
+	latency += WEIGHT * (sample - latency);
+}
+
+bool BandwidthEstimator::get_estimate(double &r_rate, double &r_deviation, double &r_latency) const {
+	MutexLock lock(mutex);
+
+	if (!has_rate) {
+		return false;
+	}
+
+	r_rate = rate;
+	r_deviation = std::sqrt(rate_variance);
+	r_latency = has_latency ? latency : 0.0;
+	return true;
+}
+
+double BandwidthEstimator::get_safe_rate() const {
+	// Two deviations below the mean, but a link is never expected to be worse than this fraction of its mean.
+	static const double DEVIATIONS = 2.0;
+	static const double MIN_FRACTION = 0.1;
+
+	double rate, deviation, latency;
+	if (!get_estimate(rate, deviation, latency)) {
+		return 0.0;
+	}
+
+	return MAX(rate - DEVIATIONS * deviation, rate * MIN_FRACTION);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "core/os/mutex.h"
+
+#include <cstdint>
+
+/**
+ * Running estimate of how fast downloads arrive, shared by the streams that download over the same network.
+ *
+ * Transfers are gathered into samples of a minimum size, since a single read says little about the link. The
+ * throughput and the latency of requests are tracked as exponentially weighted averages, along with the deviation of
+ * the throughput so that callers can plan for a slower than usual stretch. Safe to use from several threads.
+ */
+class BandwidthEstimator {
+	mutable Mutex mutex;
+
+	// Transfer time and bytes not folded into a sample yet.
+	uint64_t pending_usec = 0;
+	uint64_t pending_bytes = 0;
+
+	bool has_rate = false;
+	double rate = 0.0;
+	double rate_variance = 0.0;
+
+	bool has_latency = false;
+	double latency = 0.0;
+
+public:
+	/**
+	 * Record that `p_bytes` arrived over `p_usec` of downloading.
+	 */
+	void add_transfer(const uint64_t p_bytes, const uint64_t p_usec);
+
+	/**
+	 * Record the time between sending a request and receiving its response.
+	 */
+	void add_latency(const uint64_t p_usec);
+
+	/**
+	 * @param[out] r_rate Mean throughput, in bytes per second.
+	 * @param[out] r_deviation Standard deviation of the throughput, in bytes per second.
+	 * @param[out] r_latency Mean latency of a request, in seconds.
+	 * @returns Whether enough was downloaded for an estimate.
+	 */
+	bool get_estimate(double &r_rate, double &r_deviation, double &r_latency) const;
+
+	/**
+	 * @returns A throughput that downloads rarely fall below, in bytes per second, or zero if nothing was measured.
+	 */
+	double get_safe_rate() const;
+};
@@ -0,0 +1,153 @@
+#include "cache_file.hpp"
+
+#include "core/os/dir_access.h"
+
+void CacheFile::_finish_if_complete() {
+	if (finished || file == nullptr || !has_length) {
+		return;
+	}
+
+	if (written.size() != 1 || written.begin()->first != 0 || written.begin()->second < length) {
+		return;
+	}
+
+	file->close();
+	memdelete(file);
+	file = nullptr;
+	finished = true;
+
+	DirAccess *const dir = DirAccess::create_for_path(path);
+	dir->remove(path);
+	const Error rename_err = dir->rename(part_path, path);
+	memdelete(dir);
+	ERR_FAIL_COND_MSG(rename_err != OK, "Failed to rename file from '" + part_path + "' to '" + path + "'.");
+}
+
+void CacheFile::write(const uint64_t p_pos, const uint8_t *const p_data, const uint64_t p_bytes) {
+	MutexLock lock(mutex);
+
+	if (file == nullptr || p_bytes == 0) {
+		return;
+	}
+
+	file->seek(p_pos);
+	file->store_buffer(p_data, p_bytes);
+
+	// Merge the new interval with every interval it overlaps or touches.
+	uint64_t start = p_pos;
+	uint64_t end = p_pos + p_bytes;
+
+	std::map<uint64_t, uint64_t>::iterator it = written.upper_bound(start);
+	if (it != written.begin()) {
+		std::map<uint64_t, uint64_t>::iterator previous = it;
+		--previous;
+		if (previous->second >= start) {
+			it = previous;
+		}
+	}
+
+	while (it != written.end() && it->first <= end) {
+		start = MIN(start, it->first);
+		end = MAX(end, it->second);
+		it = written.erase(it);
+	}
+
+	written[start] = end;
+
+	_finish_if_complete();
+}
+
+void CacheFile::set_length(const uint64_t p_length) {
+	MutexLock lock(mutex);
+
+	if (has_length) {
+		return;
+	}
+
+	has_length = true;
+	length = p_length;
+
+	_finish_if_complete();
+}
+
+bool CacheFile::get_has_length() {
+	MutexLock lock(mutex);
+	return has_length;
+}
+
+bool CacheFile::is_finished() {
+	MutexLock lock(mutex);
+	return finished;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> CacheFile::get_missing() {
+	MutexLock lock(mutex);
+
+	std::vector<std::pair<uint64_t, uint64_t>> missing;
+	if (!has_length || finished) {
+		return missing;
+	}
+
+	uint64_t pos = 0;
+	for (const std::pair<const uint64_t, uint64_t> &interval : written) {
+		if (interval.first > pos) {
+			missing.emplace_back(pos, MIN(interval.first, length));
+		}
+		pos = MAX(pos, interval.second);
+	}
+
+	if (pos < length) {
+		missing.emplace_back(pos, length);
+	}
+
+	return missing;
+}
+
+bool CacheFile::claim_backfill() {
+	MutexLock lock(mutex);
+
+	if (backfilling || finished || file == nullptr) {
+		return false;
+	}
+
+	backfilling = true;
+	return true;
+}
+
+String CacheFile::get_path() const {
+	return path;
+}
+
+CacheFile::CacheFile(const String p_path) :
+		path(p_path), part_path(p_path + ".part") {
+	DirAccess *const dir = DirAccess::create_for_path(path);
+	if (!dir->dir_exists(path.get_base_dir())) {
+		const Error dir_err = dir->make_dir_recursive(path.get_base_dir());
+		if (dir_err != OK) {
+			memdelete(dir);
+			ERR_FAIL_MSG("Failed to create directory: '" + path.get_base_dir() + "'.");
+		}
+	}
+	memdelete(dir);
+
+	Error file_err;
+	file = FileAccess::open(part_path, FileAccess::WRITE, &file_err);
+	if (file_err != OK) {
+		file = nullptr;
+		ERR_FAIL_MSG("Failed to create file: '" + part_path + "'.");
+	}
+}
+
+CacheFile::~CacheFile() {
+	if (file == nullptr) {
+		return;
+	}
+
+	// Which bytes were written is only known in memory, so an incomplete part file cannot be resumed later.
+	file->close();
+	memdelete(file);
+
+	DirAccess *const dir = DirAccess::create_for_path(part_path);
+	dir->remove(part_path);
+	memdelete(dir);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "core/os/file_access.h"
+#include "core/os/mutex.h"
+#include "core/variant.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+/**
+ * Partially downloaded file on disk, filled in whatever order the bytes arrive.
+ *
+ * Bytes are written into `{path}.part`, and the file is renamed to `path` as soon as every byte up to the length has
+ * been written. Safe to write from several threads.
+ */
+class CacheFile {
+	const String path;
+	const String part_path;
+
+	Mutex mutex;
+	FileAccess *file = nullptr;
+
+	// Written bytes as [start, end) intervals keyed by start. Adjacent intervals are merged.
+	std::map<uint64_t, uint64_t> written;
+
+	bool has_length = false;
+	uint64_t length = 0;
+	bool finished = false;
+	bool backfilling = false;
+
+	/**
+	 * Promote the part file to the final file if every byte was written. The mutex must be held.
+	 */
+	void _finish_if_complete();
+
+public:
+	/**
+	 * Store downloaded bytes. Bytes that were already written are written again, which is harmless.
+	 *
+	 * @param[in] p_pos Position of the first byte in the file.
+	 * @param[in] p_data Pointer of the array to copy from.
+	 * @param[in] p_bytes Number of bytes to write.
+	 */
+	void write(const uint64_t p_pos, const uint8_t *const p_data, const uint64_t p_bytes);
+
+	void set_length(const uint64_t p_length);
+	bool get_has_length();
+	bool is_finished();
+
+	/**
+	 * @returns The [start, end) intervals that have not been written yet. Empty if the length is not known.
+	 */
+	std::vector<std::pair<uint64_t, uint64_t>> get_missing();
+
+	/**
+	 * Claim the job of downloading the missing bytes, so that only one thread backfills the file.
+	 *
+	 * @returns Whether the caller should backfill the file.
+	 */
+	bool claim_backfill();
+
+	String get_path() const;
+
+	CacheFile(const String p_path);
+	~CacheFile();
+};
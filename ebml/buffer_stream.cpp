@@ -2,6 +2,8 @@
 
 #include "typedefs.hpp"
 
+#include <cstring>
+
 namespace ebml {
 void BufferStream::read(uint8_t *const p_buffer, uint64_t &p_pos, const uint64_t p_bytes) {
 	if (p_pos < 0 || p_pos + p_bytes > size) {
@@ -16,13 +18,19 @@ void BufferStream::read(uint8_t *const p_buffer, uint64_t &p_pos, const uint64_t
 #endif
 	}
 
-	for (uint64_t i = 0; i < p_bytes; ++i) {
-		p_buffer[i] = data[p_pos + i];
-	}
+	memcpy(p_buffer, data + p_pos, p_bytes);
 
 	p_pos += p_bytes;
 }
 
+const uint8_t *BufferStream::window(const uint64_t p_pos, const uint64_t p_bytes) {
+	if (p_pos + p_bytes > size) {
+		return nullptr;
+	}
+
+	return data + p_pos;
+}
+
 uint64_t BufferStream::get_length() {
 	return size;
 }
@@ -9,6 +9,7 @@ class BufferStream : public Stream {
 
 public:
 	virtual void read(uint8_t *const p_buffer, uint64_t &p_pos, const uint64_t p_bytes);
+	virtual const uint8_t *window(const uint64_t p_pos, const uint64_t p_bytes);
 	virtual uint64_t get_length();
 
 	BufferStream(const uint8_t *const p_data, const uint64_t p_size);
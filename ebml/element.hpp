@@ -9,14 +9,14 @@
 
 namespace ebml {
 struct Element {
-	const ElementRegister reg;
+	const ElementRegister &reg;
 	const uint64_t pos;
 
 	virtual void debug_print() const {
 		std::cout << "\"name\": \"" << reg.name << "\"";
 	}
 
-	Element(const ElementRegister p_reg, const uint64_t p_pos) :
+	Element(const ElementRegister &p_reg, const uint64_t p_pos) :
 			reg(p_reg), pos(p_pos) {}
 	virtual ~Element() {}
 };
@@ -30,7 +30,7 @@ struct ElementMaster : public Element {
 	}
 
 	ElementMaster(
-			const ElementRegister p_reg,
+			const ElementRegister &p_reg,
 			const uint64_t p_pos,
 			const uint64_t p_from,
 			const uint64_t p_to) :
@@ -47,7 +47,7 @@ struct ElementUint : public Element {
 	}
 
 	ElementUint(
-			const ElementRegister p_reg,
+			const ElementRegister &p_reg,
 			const uint64_t p_pos,
 			const uint64_t p_value) :
 			Element(p_reg, p_pos), value(p_value) {}
@@ -63,7 +63,7 @@ struct ElementInt : public Element {
 	}
 
 	ElementInt(
-			const ElementRegister p_reg,
+			const ElementRegister &p_reg,
 			const uint64_t p_pos,
 			const int64_t p_value) :
 			Element(p_reg, p_pos), value(p_value) {}
@@ -79,7 +79,7 @@ struct ElementString : public Element {
 	}
 
 	ElementString(
-			const ElementRegister p_reg,
+			const ElementRegister &p_reg,
 			const uint64_t p_pos,
 			const std::string p_value) :
 			Element(p_reg, p_pos), value(p_value) {}
@@ -96,7 +96,7 @@ struct ElementBinary : public Element {
 	}
 
 	ElementBinary(
-			const ElementRegister p_reg,
+			const ElementRegister &p_reg,
 			const uint64_t p_pos,
 			const uint8_t *const p_data,
 			const uint64_t p_size) :
@@ -115,7 +115,7 @@ struct ElementFloat : public Element {
 	}
 
 	ElementFloat(
-			const ElementRegister p_reg,
+			const ElementRegister &p_reg,
 			const uint64_t p_pos,
 			const double p_value) :
 			Element(p_reg, p_pos), value(p_value) {}
@@ -131,7 +131,7 @@ struct ElementDate : public Element {
 	}
 
 	ElementDate(
-			const ElementRegister p_reg,
+			const ElementRegister &p_reg,
 			const int64_t p_value,
 			const uint64_t p_pos) :
 			Element(p_reg, p_pos), value(p_value) {}
@@ -1,16 +1,49 @@
 #include "element_register.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 
 namespace ebml {
-// TODO: Binary search, or just a map.
-ElementRegister get_register(const ElementID &p_id) {
-	for (ElementRegister reg : ELEMENT_REGISTERS) {
-		if (reg.id == p_id) {
-			return reg;
+// Number of unknown IDs to report before going quiet.
+static const uint64_t MAX_UNKNOWN_WARNINGS = 16;
+
+static const uint64_t REGISTER_COUNT = sizeof(ELEMENT_REGISTERS) / sizeof(ELEMENT_REGISTERS[0]);
+
+/**
+ * Registers sorted by ID, so they can be binary searched.
+ */
+struct SortedRegisters {
+	const ElementRegister *items[REGISTER_COUNT];
+
+	SortedRegisters() {
+		for (uint64_t i = 0; i < REGISTER_COUNT; ++i) {
+			items[i] = &ELEMENT_REGISTERS[i];
 		}
+		std::sort(items, items + REGISTER_COUNT, [](const ElementRegister *a, const ElementRegister *b) {
+			return a->id < b->id;
+		});
+	}
+};
+
+const ElementRegister &get_register(const ElementID &p_id) {
+	static const SortedRegisters sorted;
+
+	const ElementRegister *const *const end = sorted.items + REGISTER_COUNT;
+	const ElementRegister *const *const it = std::lower_bound(sorted.items, end, p_id, [](const ElementRegister *a, const ElementID &b) {
+		return a->id < b;
+	});
+	if (it != end && (*it)->id == p_id) {
+		return **it;
+	}
+
+	static std::atomic<uint64_t> unknown_count(0);
+	const uint64_t count = unknown_count++;
+	if (count < MAX_UNKNOWN_WARNINGS) {
+		std::cerr << "WARNING: Unknown register: " << p_id << "." << std::endl;
+	} else if (count == MAX_UNKNOWN_WARNINGS) {
+		std::cerr << "WARNING: Too many unknown registers, no longer reporting them." << std::endl;
 	}
-	std::cerr << "WARNING: Unknown register: " << p_id << "." << std::endl;
 	return ELEMENT_REGISTER_UNKNOWN;
 }
 }; // namespace ebml
@@ -191,5 +191,14 @@ const ElementRegister ELEMENT_REGISTERS[] = {
 	{ ELEMENT_CHAP_PROCESS_DATA, ELEMENT_TYPE_BINARY, "ChapProcessData" },
 };
 
-ElementRegister get_register(const ElementID &p_id);
+/**
+ * Look up the register of an element ID.
+ *
+ * Unknown IDs resolve to `ELEMENT_REGISTER_UNKNOWN`. Only the first few of them are reported, since a single stream
+ * can contain thousands.
+ *
+ * @param[in] p_id The ID of the element.
+ * @returns The register of the element, which stays valid for the lifetime of the program.
+ */
+const ElementRegister &get_register(const ElementID &p_id);
 }; // namespace ebml
@@ -83,14 +83,29 @@ ebml::ElementRange::ElementRange(
 }
 
 std::string ebml::Stream::ebml_read_string(uint64_t &p_pos, const uint64_t p_size) {
-	uint8_t *const data = new uint8_t[p_size + 1];
-	data[p_size] = '\0';
-	read(data, p_pos, p_size);
-	std::string result((char *)data);
-	delete[] data;
+	std::string result;
+
+	const uint8_t *const data = window(p_pos, p_size);
+	if (data != nullptr) {
+		result.assign((const char *)data, p_size);
+		p_pos += p_size;
+	} else {
+		result.resize(p_size);
+		read((uint8_t *)&result[0], p_pos, p_size);
+	}
+
+	// Strings may be padded with null characters.
+	const size_t length = result.find('\0');
+	if (length != std::string::npos) {
+		result.resize(length);
+	}
 	return result;
 }
 
+const uint8_t *ebml::Stream::window(const uint64_t p_pos, const uint64_t p_bytes) {
+	return nullptr;
+}
+
 void ebml::Stream::read_int(uint64_t &p_pos, int64_t &r_result) {
 	read_num<int64_t, true>(p_pos, r_result);
 }
@@ -103,6 +118,10 @@ void ebml::Stream::read_size(uint64_t &p_pos, ElementSize &r_result) {
 	read_num<ElementSize, true>(p_pos, r_result);
 }
 
+void ebml::Stream::read_binary(uint64_t &p_pos, uint8_t *const r_buffer, const uint64_t p_bytes) {
+	read(r_buffer, p_pos, p_bytes);
+}
+
 void ebml::Stream::read_element(uint64_t &p_pos, const Element *&r_element) {
 	uint64_t pos = p_pos;
 
@@ -166,6 +185,19 @@ void ebml::Stream::read_element(uint64_t &p_pos, const Element *&r_element) {
 	r_element = element;
 }
 
+void ebml::Stream::prefetch(const uint64_t p_pos, const uint64_t p_bytes) {
+}
+
+void ebml::Stream::load_ranges(const std::vector<std::pair<uint64_t, uint64_t>> &p_ranges) {
+	for (const std::pair<uint64_t, uint64_t> &range : p_ranges) {
+		prefetch(range.first, range.second - range.first);
+	}
+}
+
+bool ebml::Stream::get_bandwidth(double &r_rate, double &r_deviation, double &r_latency) {
+	return false;
+}
+
 ebml::ElementRange ebml::Stream::range(const ElementMaster *const p_element) {
 	return ElementRange(this, p_element->from, p_element->to);
 }
@@ -136,6 +136,51 @@ protected:
 	virtual void read(uint8_t *const p_buffer, uint64_t &p_pos, const uint64_t p_bytes) = 0;
 
 public:
+	/**
+	 * Virtual method to access bytes of the input without copying them.
+	 *
+	 * Implementations should return a pointer to `p_bytes` contiguous bytes starting at `p_pos`, or `nullptr` if they
+	 * cannot provide them that way, in which case the caller falls back to `read`. The pointer only has to stay valid
+	 * until the next call on the stream.
+	 *
+	 * @param[in] p_pos Position of the first byte in the input data.
+	 * @param[in] p_bytes Number of bytes needed.
+	 * @returns A pointer to the bytes, or `nullptr`.
+	 */
+	virtual const uint8_t *window(const uint64_t p_pos, const uint64_t p_bytes);
+
+	/**
+	 * Virtual method to hint that a range of the input will be read soon.
+	 *
+	 * Implementations may use this to start loading the bytes in the background. The default does nothing.
+	 *
+	 * @param[in] p_pos Position of the first byte in the input data.
+	 * @param[in] p_bytes Number of bytes that will be read.
+	 */
+	virtual void prefetch(const uint64_t p_pos, const uint64_t p_bytes);
+
+	/**
+	 * Virtual method to load several ranges of the input before they are read.
+	 *
+	 * Implementations that download the input should fetch the ranges concurrently, so that they cost a single round
+	 * trip. The default only hints each range with `prefetch`.
+	 *
+	 * @param[in] p_ranges Position of the first byte and position after the last byte of each range.
+	 */
+	virtual void load_ranges(const std::vector<std::pair<uint64_t, uint64_t>> &p_ranges);
+
+	/**
+	 * Virtual method to report how fast the input arrives, for inputs that are downloaded.
+	 *
+	 * The default reports nothing, meaning that reads are fast enough not to plan for.
+	 *
+	 * @param[out] r_rate Mean throughput, in bytes per second.
+	 * @param[out] r_deviation Standard deviation of the throughput, in bytes per second.
+	 * @param[out] r_latency Time until the first byte of a read that is not loaded yet arrives, in seconds.
+	 * @returns Whether an estimate is available.
+	 */
+	virtual bool get_bandwidth(double &r_rate, double &r_deviation, double &r_latency);
+
 	/**
 	 * Virtual method to get the total length of the input data.
 	 *
@@ -167,6 +212,15 @@ public:
 	 */
 	void read_size(uint64_t &p_pos, ElementSize &r_result);
 
+	/**
+	 * Read raw bytes from the stream, such as the payload of a binary element.
+	 *
+	 * @param[in, out] p_pos Position to read from in the input data. Will be incremented if the read is successful.
+	 * @param[out] r_buffer Pointer of the array to write into.
+	 * @param[in] p_bytes Number of bytes to read.
+	 */
+	void read_binary(uint64_t &p_pos, uint8_t *const r_buffer, const uint64_t p_bytes);
+
 	/**
 	 * Read an EBML element from the stream according to the EBML specification.
 	 *
@@ -199,44 +253,62 @@ public:
 
 template <class T, bool strip_leading>
 void ebml::Stream::read_num(uint64_t &p_pos, T &r_result) {
-	uint64_t pos = p_pos;
-
-	uint8_t first;
+	uint8_t buffer[sizeof(T)];
+
+	const uint8_t *const first = window(p_pos, 1);
+	if (first != nullptr) {
+		buffer[0] = *first;
+	} else {
+		uint64_t pos = p_pos;
+		read(buffer, pos, 1);
+	}
 
-	read(&first, pos, 1);
+	// The number of leading zeros tells how many octets follow the first one.
+	uint8_t octets = 0;
+	while (octets + 1u < sizeof(T) && !(buffer[0] & (0b10000000 >> octets))) {
+		++octets;
+	}
 
-	T full = 0;
-	for (uint8_t octets = 0; octets < sizeof(T); ++octets) {
-		uint64_t mask = 0b10000000 >> octets;
-		if (first & mask) {
-			if (strip_leading) {
-				first ^= mask;
-			}
-			full |= first << octets * 8;
-			break;
+	const uint8_t *data = buffer;
+	if (octets > 0) {
+		data = window(p_pos, octets + 1);
+		if (data == nullptr) {
+			uint64_t pos = p_pos + 1;
+			read(buffer + 1, pos, octets);
+			data = buffer;
 		}
+	}
 
-		uint8_t next;
-		read(&next, pos, 1);
-
+	T full = strip_leading ? data[0] & ~(0b10000000 >> octets) : data[0];
+	for (uint8_t i = 1; i <= octets; ++i) {
 		full <<= 8;
-		full |= next;
+		full |= data[i];
 	}
 
-	p_pos = pos;
+	p_pos += octets + 1;
 	r_result = full;
 }
 
 template <class T>
 T ebml::Stream::ebml_read_copy_reverse(uint64_t &p_pos, const uint64_t p_size) {
-	uint8_t *const data = new uint8_t[p_size];
-	read(data, p_pos, p_size);
+	// Anything beyond the size of the result can only be leading zeros.
+	const uint64_t size = std::min<uint64_t>(p_size, sizeof(T));
+	p_pos += p_size - size;
+
+	uint8_t buffer[sizeof(T)];
+	const uint8_t *data = window(p_pos, size);
+	if (data != nullptr) {
+		p_pos += size;
+	} else {
+		read(buffer, p_pos, size);
+		data = buffer;
+	}
+
 	T result = T();
 	uint8_t *const result_ptr = (uint8_t *)&result;
-	for (uint64_t i = 0; i < p_size; ++i) {
-		result_ptr[i] = data[p_size - i - 1];
+	for (uint64_t i = 0; i < size; ++i) {
+		result_ptr[i] = data[size - i - 1];
 	}
-	delete[] data;
 	return result;
 }
 
@@ -0,0 +1,522 @@
+#include "http_connection.hpp"
+
+#include <climits>
+#include <cstring>
+
+Error HttpConnection::_receive(uint8_t *const r_buffer, const uint64_t p_bytes, uint64_t &r_received) {
+	r_received = 0;
+
+	if (head_pos < head.size()) {
+		const uint64_t copy = MIN(p_bytes, head.size() - head_pos);
+		memcpy(r_buffer, head.data() + head_pos, copy);
+		head_pos += copy;
+		r_received = copy;
+		return OK;
+	}
+
+	int received = 0;
+	const Error err = connection->get_partial_data(r_buffer, MIN(p_bytes, (uint64_t)INT_MAX), received);
+	if (err != OK) {
+		return err;
+	}
+
+	r_received = received;
+	return OK;
+}
+
+bool HttpConnection::_parse_line(const char *const p_line, const uint64_t p_length) {
+	if (!has_status_line) {
+		// "HTTP/1.1 206 Partial Content"
+		String line;
+		line.parse_utf8(p_line, p_length);
+
+		const int space = line.find(" ");
+		ERR_FAIL_COND_V_MSG(space < 0, false, "Invalid status line: '" + line + "'.");
+
+		response_code = line.substr(space + 1, 3).to_int();
+		keep_alive = !line.begins_with("HTTP/1.0");
+		has_status_line = true;
+		return false;
+	}
+
+	if (p_length == 0) {
+		return true;
+	}
+
+	String header;
+	header.parse_utf8(p_line, p_length);
+	response_headers.push_back(header);
+
+	const int colon = header.find(":");
+	if (colon < 0) {
+		return false;
+	}
+
+	const String name = header.substr(0, colon).strip_edges().to_lower();
+	const String value = header.substr(colon + 1).strip_edges();
+
+	if (name == "content-length") {
+		body_length = value.to_int64();
+	} else if (name == "transfer-encoding") {
+		chunked = value.to_lower().find("chunked") >= 0;
+	} else if (name == "connection") {
+		const String token = value.to_lower();
+		if (token == "close") {
+			keep_alive = false;
+		} else if (token == "keep-alive") {
+			keep_alive = true;
+		}
+	} else if (name == "content-range") {
+		// "bytes 0-99/1234"
+		const String total = value.substr(value.rfind("/") + 1).strip_edges();
+		if (total != "*") {
+			response_total_length = total.to_int64();
+		}
+	} else if (name == "location") {
+		response_location = value;
+	}
+
+	return false;
+}
+
+bool HttpConnection::_read_chunk_framing() {
+	while (chunk_state != CHUNK_DATA) {
+		// Framing lines are a few bytes long, so they are read byte by byte.
+		uint8_t c;
+		uint64_t received;
+		const Error err = _receive(&c, 1, received);
+		if (err != OK) {
+			close();
+			status = STATUS_CONNECTION_ERROR;
+			return false;
+		}
+		if (received == 0) {
+			return false;
+		}
+
+		if (c != '\n') {
+			if (c != '\r') {
+				chunk_line += (CharType)c;
+			}
+			continue;
+		}
+
+		const String line = chunk_line;
+		chunk_line = String();
+
+		switch (chunk_state) {
+			case CHUNK_SIZE: {
+				// "1a2b;extension=value"
+				const int extension = line.find(";");
+				const String size = extension >= 0 ? line.substr(0, extension) : line;
+				chunk_left = size.strip_edges().hex_to_int64(false);
+				chunk_state = chunk_left != 0 ? CHUNK_DATA : CHUNK_TRAILER;
+			} break;
+			case CHUNK_DATA_END: {
+				chunk_state = CHUNK_SIZE;
+			} break;
+			case CHUNK_TRAILER: {
+				if (line.empty()) {
+					_finish_body();
+					return false;
+				}
+			} break;
+			case CHUNK_DATA: {
+			} break;
+		}
+	}
+
+	return true;
+}
+
+void HttpConnection::_start_body() {
+	status = STATUS_BODY;
+
+	if (chunked) {
+		body_length = -1;
+		body_left = -1;
+		chunk_state = CHUNK_SIZE;
+	} else if (body_length >= 0) {
+		body_left = body_length;
+	} else {
+		// Without a length the body lasts until the server closes the connection.
+		keep_alive = false;
+		body_left = -1;
+	}
+}
+
+void HttpConnection::_finish_body() {
+	if (keep_alive) {
+		status = STATUS_CONNECTED;
+	} else {
+		close();
+	}
+}
+
+void HttpConnection::_reset_response() {
+	head.clear();
+	line_start = 0;
+	head_pos = 0;
+	has_status_line = false;
+	has_head = false;
+
+	response_code = 0;
+	response_headers.clear();
+	response_location = String();
+	response_total_length = -1;
+	keep_alive = true;
+
+	body_length = -1;
+	body_left = -1;
+	chunked = false;
+	chunk_state = CHUNK_SIZE;
+	chunk_left = 0;
+	chunk_line = String();
+}
+
+Error HttpConnection::connect_to_host(const String p_host) {
+	close();
+
+	String address = p_host;
+	use_ssl = false;
+	port = 80;
+	if (address.begins_with("https://")) {
+		use_ssl = true;
+		port = 443;
+		address = address.substr(8);
+	} else if (address.begins_with("http://")) {
+		address = address.substr(7);
+	}
+
+	const int slash = address.find("/");
+	if (slash >= 0) {
+		address = address.substr(0, slash);
+	}
+
+	const int colon = address.rfind(":");
+	if (colon >= 0 && address.substr(colon + 1).is_valid_integer()) {
+		port = address.substr(colon + 1).to_int();
+		address = address.substr(0, colon);
+	}
+
+	host = address;
+	ERR_FAIL_COND_V_MSG(host.empty(), ERR_INVALID_PARAMETER, "Invalid host: '" + p_host + "'.");
+
+	if (host.is_valid_ip_address()) {
+		tcp.instance();
+		const Error err = tcp->connect_to_host(IP_Address(host), port);
+		if (err != OK) {
+			status = STATUS_CANT_CONNECT;
+			return err;
+		}
+		status = STATUS_CONNECTING;
+	} else {
+		resolving = IP::get_singleton()->resolve_hostname_queue_item(host);
+		status = STATUS_RESOLVING;
+	}
+
+	return OK;
+}
+
+Error HttpConnection::request(const Method p_method, const String p_path, const Vector<String> &p_headers, const String p_body) {
+	ERR_FAIL_COND_V_MSG(status != STATUS_CONNECTED, ERR_INVALID_PARAMETER, "Not connected.");
+
+	_reset_response();
+
+	String text = String(p_method == METHOD_POST ? "POST " : "GET ") + p_path + " HTTP/1.1\r\n";
+	text += "Host: " + host;
+	if (port != (use_ssl ? 443 : 80)) {
+		text += ":" + String::num_int64(port);
+	}
+	text += "\r\n";
+
+	bool has_user_agent = false;
+	bool has_accept = false;
+	for (int i = 0; i < p_headers.size(); ++i) {
+		const String name = p_headers[i].to_lower();
+		has_user_agent = has_user_agent || name.begins_with("user-agent:");
+		has_accept = has_accept || name.begins_with("accept:");
+		text += p_headers[i] + "\r\n";
+	}
+	if (!has_user_agent) {
+		text += "User-Agent: GodotEngine\r\n";
+	}
+	if (!has_accept) {
+		text += "Accept: */*\r\n";
+	}
+
+	const CharString body = p_body.utf8();
+	if (p_method == METHOD_POST || body.length() != 0) {
+		text += "Content-Length: " + String::num_int64(body.length()) + "\r\n";
+	}
+	text += "\r\n";
+
+	const CharString head_text = text.utf8();
+	request_data.assign(head_text.get_data(), head_text.get_data() + head_text.length());
+	request_data.insert(request_data.end(), body.get_data(), body.get_data() + body.length());
+	request_sent = 0;
+
+	status = STATUS_REQUESTING;
+	return OK;
+}
+
+Error HttpConnection::poll() {
+	// Limit on the size of a response head, to not grow forever on garbage.
+	static const uint64_t MAX_HEAD_SIZE = 65536;
+	static const uint64_t HEAD_READ_SIZE = 4096;
+
+	if (ssl.is_valid()) {
+		ssl->poll();
+	}
+
+	switch (status) {
+		case STATUS_RESOLVING: {
+			switch (IP::get_singleton()->get_resolve_item_status(resolving)) {
+				case IP::RESOLVER_STATUS_WAITING: {
+				} break;
+				case IP::RESOLVER_STATUS_DONE: {
+					const IP_Address address = IP::get_singleton()->get_resolve_item_address(resolving);
+					IP::get_singleton()->erase_resolve_item(resolving);
+					resolving = IP::RESOLVER_INVALID_ID;
+
+					tcp.instance();
+					const Error err = tcp->connect_to_host(address, port);
+					if (err != OK) {
+						status = STATUS_CANT_CONNECT;
+						return err;
+					}
+					status = STATUS_CONNECTING;
+				} break;
+				default: {
+					IP::get_singleton()->erase_resolve_item(resolving);
+					resolving = IP::RESOLVER_INVALID_ID;
+					status = STATUS_CANT_RESOLVE;
+					return ERR_CANT_RESOLVE;
+				} break;
+			}
+		} break;
+		case STATUS_CONNECTING: {
+			if (ssl.is_valid()) {
+				switch (ssl->get_status()) {
+					case StreamPeerSSL::STATUS_HANDSHAKING: {
+					} break;
+					case StreamPeerSSL::STATUS_CONNECTED: {
+						status = STATUS_CONNECTED;
+					} break;
+					default: {
+						close();
+						status = STATUS_SSL_HANDSHAKE_ERROR;
+						return ERR_CANT_CONNECT;
+					} break;
+				}
+				break;
+			}
+
+			switch (tcp->get_status()) {
+				case StreamPeerTCP::STATUS_CONNECTING: {
+				} break;
+				case StreamPeerTCP::STATUS_CONNECTED: {
+					tcp->set_no_delay(true);
+					if (!use_ssl) {
+						connection = tcp;
+						status = STATUS_CONNECTED;
+						break;
+					}
+
+					ssl = Ref<StreamPeerSSL>(StreamPeerSSL::create());
+					ssl->set_blocking_handshake_enabled(false);
+					const Error err = ssl->connect_to_stream(tcp, true, host);
+					if (err != OK) {
+						close();
+						status = STATUS_SSL_HANDSHAKE_ERROR;
+						return ERR_CANT_CONNECT;
+					}
+					connection = ssl;
+				} break;
+				default: {
+					close();
+					status = STATUS_CANT_CONNECT;
+					return ERR_CANT_CONNECT;
+				} break;
+			}
+		} break;
+		case STATUS_REQUESTING: {
+			while (request_sent < request_data.size()) {
+				int sent = 0;
+				const Error err = connection->put_partial_data(request_data.data() + request_sent, request_data.size() - request_sent, sent);
+				if (err != OK) {
+					close();
+					status = STATUS_CONNECTION_ERROR;
+					return ERR_CONNECTION_ERROR;
+				}
+				if (sent == 0) {
+					return OK;
+				}
+				request_sent += sent;
+			}
+
+			while (true) {
+				const uint64_t old_size = head.size();
+				head.resize(old_size + HEAD_READ_SIZE);
+
+				int received = 0;
+				const Error err = connection->get_partial_data(head.data() + old_size, HEAD_READ_SIZE, received);
+				head.resize(old_size + (err == OK ? received : 0));
+				if (err != OK) {
+					close();
+					status = STATUS_CONNECTION_ERROR;
+					return ERR_CONNECTION_ERROR;
+				}
+				if (received == 0) {
+					return OK;
+				}
+
+				// Only the new bytes are scanned, and each line is parsed once it is complete.
+				for (uint64_t i = old_size; i < head.size(); ++i) {
+					if (head[i] != '\n') {
+						continue;
+					}
+
+					uint64_t end = i;
+					if (end > line_start && head[end - 1] == '\r') {
+						--end;
+					}
+
+					const bool blank = _parse_line((const char *)head.data() + line_start, end - line_start);
+					line_start = i + 1;
+
+					if (blank) {
+						has_head = true;
+						head_pos = line_start;
+						_start_body();
+						return OK;
+					}
+				}
+
+				if (head.size() > MAX_HEAD_SIZE) {
+					close();
+					status = STATUS_CONNECTION_ERROR;
+					ERR_FAIL_V_MSG(ERR_CONNECTION_ERROR, "Response head is too large.");
+				}
+			}
+		} break;
+		default: {
+		} break;
+	}
+
+	return OK;
+}
+
+uint64_t HttpConnection::read_body(uint8_t *const r_buffer, const uint64_t p_bytes) {
+	if (status != STATUS_BODY) {
+		return 0;
+	}
+
+	if (body_left == 0) {
+		_finish_body();
+		return 0;
+	}
+
+	uint64_t bytes = p_bytes;
+	if (chunked) {
+		if (!_read_chunk_framing()) {
+			return 0;
+		}
+		bytes = MIN(bytes, chunk_left);
+	} else if (body_left > 0) {
+		bytes = MIN(bytes, (uint64_t)body_left);
+	}
+
+	uint64_t received = 0;
+	const Error err = _receive(r_buffer, bytes, received);
+	if (err != OK) {
+		if (!chunked && body_left < 0) {
+			// The server closing the connection is how this body ends.
+			_finish_body();
+			return 0;
+		}
+
+		close();
+		status = STATUS_CONNECTION_ERROR;
+		return 0;
+	}
+
+	if (chunked) {
+		chunk_left -= received;
+		if (chunk_left == 0) {
+			chunk_state = CHUNK_DATA_END;
+		}
+	} else if (body_left > 0) {
+		body_left -= received;
+		if (body_left == 0) {
+			_finish_body();
+		}
+	}
+
+	return received;
+}
+
+HttpConnection::Status HttpConnection::get_status() {
+	// Notice a kept alive connection that was closed in the meantime.
+	if (status == STATUS_CONNECTED && tcp.is_valid() && tcp->get_status() != StreamPeerTCP::STATUS_CONNECTED) {
+		close();
+	}
+
+	return status;
+}
+
+bool HttpConnection::has_response() const {
+	return has_head;
+}
+
+int HttpConnection::get_response_code() const {
+	return response_code;
+}
+
+Error HttpConnection::get_response_headers(List<String> *r_headers) const {
+	ERR_FAIL_COND_V(!has_head, ERR_UNAVAILABLE);
+
+	for (const List<String>::Element *E = response_headers.front(); E; E = E->next()) {
+		r_headers->push_back(E->get());
+	}
+	return OK;
+}
+
+int64_t HttpConnection::get_response_body_length() const {
+	return body_length;
+}
+
+int64_t HttpConnection::get_response_total_length() const {
+	return response_total_length;
+}
+
+String HttpConnection::get_response_location() const {
+	return response_location;
+}
+
+void HttpConnection::close() {
+	if (resolving != IP::RESOLVER_INVALID_ID) {
+		IP::get_singleton()->erase_resolve_item(resolving);
+		resolving = IP::RESOLVER_INVALID_ID;
+	}
+	if (ssl.is_valid()) {
+		ssl->disconnect_from_stream();
+		ssl.unref();
+	}
+	if (tcp.is_valid()) {
+		tcp->disconnect_from_host();
+		tcp.unref();
+	}
+	connection.unref();
+
+	request_data.clear();
+	request_sent = 0;
+	status = STATUS_DISCONNECTED;
+}
+
+HttpConnection::HttpConnection() {
+}
+
+HttpConnection::~HttpConnection() {
+	close();
+}
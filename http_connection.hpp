@@ -0,0 +1,158 @@
+#pragma once
+
+#include "core/io/ip.h"
+#include "core/io/stream_peer_ssl.h"
+#include "core/io/stream_peer_tcp.h"
+#include "core/variant.h"
+
+#include <vector>
+
+/**
+ * Minimal non-blocking HTTP/1.1 client on top of `StreamPeerTCP` and `StreamPeerSSL`.
+ *
+ * Used like Godot's `HTTPClient`, except that the body is received straight into a buffer owned by the caller instead
+ * of a new `PoolByteArray` for every chunk. The response head is parsed in a single pass as it arrives.
+ */
+class HttpConnection {
+public:
+	enum Status {
+		STATUS_DISCONNECTED,
+		STATUS_RESOLVING,
+		STATUS_CANT_RESOLVE,
+		STATUS_CONNECTING,
+		STATUS_CANT_CONNECT,
+		STATUS_CONNECTED,
+		STATUS_REQUESTING,
+		STATUS_BODY,
+		STATUS_CONNECTION_ERROR,
+		STATUS_SSL_HANDSHAKE_ERROR,
+	};
+
+	enum Method {
+		METHOD_GET,
+		METHOD_POST,
+	};
+
+private:
+	enum ChunkState {
+		CHUNK_SIZE,
+		CHUNK_DATA,
+		CHUNK_DATA_END,
+		CHUNK_TRAILER,
+	};
+
+	Status status = STATUS_DISCONNECTED;
+
+	String host;
+	int port = 80;
+	bool use_ssl = false;
+
+	IP::ResolverID resolving = IP::RESOLVER_INVALID_ID;
+	Ref<StreamPeerTCP> tcp;
+	Ref<StreamPeerSSL> ssl;
+	Ref<StreamPeer> connection;
+
+	// Request bytes that were not sent yet.
+	std::vector<uint8_t> request_data;
+	uint64_t request_sent = 0;
+
+	// Response head as received. Lines are parsed as soon as they are complete, starting at `line_start`. Bytes after
+	// the head belong to the body and are handed out from `head_pos` before reading from the connection again.
+	std::vector<uint8_t> head;
+	uint64_t line_start = 0;
+	uint64_t head_pos = 0;
+	bool has_status_line = false;
+	bool has_head = false;
+
+	int response_code = 0;
+	List<String> response_headers;
+	String response_location;
+	int64_t response_total_length = -1;
+	bool keep_alive = true;
+
+	// Body framing. `body_left` is -1 when the body is chunked or lasts until the connection closes.
+	int64_t body_length = -1;
+	int64_t body_left = -1;
+	bool chunked = false;
+	ChunkState chunk_state = CHUNK_SIZE;
+	uint64_t chunk_left = 0;
+	String chunk_line;
+
+	/**
+	 * Receive bytes, handing out what was read past the response head first.
+	 */
+	Error _receive(uint8_t *const r_buffer, const uint64_t p_bytes, uint64_t &r_received);
+
+	/**
+	 * Parse a complete line of the response head.
+	 *
+	 * @returns Whether it was the blank line ending the head.
+	 */
+	bool _parse_line(const char *const p_line, const uint64_t p_length);
+
+	/**
+	 * Read chunked encoding framing until body bytes are available.
+	 *
+	 * @returns Whether body bytes can be read.
+	 */
+	bool _read_chunk_framing();
+
+	/**
+	 * Decide how the body is framed once the head was received.
+	 */
+	void _start_body();
+	void _finish_body();
+	void _reset_response();
+
+public:
+	/**
+	 * Start connecting.
+	 *
+	 * @param[in] p_host Host with an optional "http://" or "https://" scheme and ":port" suffix.
+	 */
+	Error connect_to_host(const String p_host);
+
+	/**
+	 * Send a request. The connection must be in `STATUS_CONNECTED`.
+	 */
+	Error request(const Method p_method, const String p_path, const Vector<String> &p_headers, const String p_body = String());
+
+	/**
+	 * Advance connecting, sending and receiving the response head without blocking.
+	 */
+	Error poll();
+
+	/**
+	 * Receive body bytes straight into `r_buffer`. The status becomes `STATUS_CONNECTED` once the body is over.
+	 *
+	 * @param[out] r_buffer Pointer of the array to receive into.
+	 * @param[in] p_bytes Maximum number of bytes to receive.
+	 * @returns The number of bytes received, zero if none have arrived yet.
+	 */
+	uint64_t read_body(uint8_t *const r_buffer, const uint64_t p_bytes);
+
+	Status get_status();
+	bool has_response() const;
+	int get_response_code() const;
+	Error get_response_headers(List<String> *r_headers) const;
+
+	/**
+	 * @returns The Content-Length of the response, or -1 if it is not known.
+	 */
+	int64_t get_response_body_length() const;
+
+	/**
+	 * @returns The total length from "Content-Range: bytes 0-99/1234", or -1 if it is not known.
+	 */
+	int64_t get_response_total_length() const;
+
+	/**
+	 * @returns The Location header of the response, empty if there is none.
+	 */
+	String get_response_location() const;
+
+	void close();
+
+	HttpConnection();
+	~HttpConnection();
+};
@@ -0,0 +1,69 @@
+#include "http_pool.hpp"
+
+#include "core/os/os.h"
+
+HttpConnection *HttpPool::acquire(const String p_host) {
+	{
+		MutexLock lock(mutex);
+
+		const uint64_t now = OS::get_singleton()->get_ticks_msec();
+
+		std::vector<IdleClient> &clients = idle[p_host];
+		while (!clients.empty()) {
+			const IdleClient entry = clients.back();
+			clients.pop_back();
+
+			// The server has most likely dropped the connection by now.
+			if (now - entry.since > idle_timeout || entry.client->get_status() != HttpConnection::STATUS_CONNECTED) {
+				memdelete(entry.client);
+				continue;
+			}
+
+			return entry.client;
+		}
+	}
+
+	return memnew(HttpConnection);
+}
+
+void HttpPool::release(const String p_host, HttpConnection *const p_client) {
+	if (p_client == nullptr) {
+		return;
+	}
+
+	if (p_client->get_status() == HttpConnection::STATUS_CONNECTED) {
+		MutexLock lock(mutex);
+
+		std::vector<IdleClient> &clients = idle[p_host];
+		if (clients.size() < max_idle_per_host) {
+			clients.push_back({ p_client, OS::get_singleton()->get_ticks_msec() });
+			return;
+		}
+	}
+
+	memdelete(p_client);
+}
+
+HttpReactor &HttpPool::get_reactor() {
+	return reactor;
+}
+
+HttpPool::HttpPool(const uint64_t p_idle_timeout, const uint64_t p_max_idle_per_host) :
+		idle_timeout(p_idle_timeout), max_idle_per_host(p_max_idle_per_host) {
+}
+
+HttpPool::~HttpPool() {
+	for (std::pair<const String, std::vector<IdleClient>> &host : idle) {
+		for (const IdleClient &entry : host.second) {
+			memdelete(entry.client);
+		}
+	}
+}
+
+PooledClient::PooledClient(HttpPool &p_pool, const String p_host) :
+		pool(p_pool), host(p_host), client(p_pool.acquire(p_host)) {
+}
+
+PooledClient::~PooledClient() {
+	pool.release(host, client);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "http_connection.hpp"
+#include "http_reactor.hpp"
+
+#include "core/os/mutex.h"
+#include "core/variant.h"
+
+#include <map>
+#include <vector>
+
+/**
+ * Pool of persistent HTTP/1.1 connections, keyed by host.
+ *
+ * Connections that finished their request are kept alive for a while, so the next request to the same host skips DNS
+ * resolution and the TLS handshake. Safe to use from several threads.
+ *
+ * The pool also owns the reactor thread that drives the transfers on its connections.
+ */
+class HttpPool {
+	struct IdleClient {
+		HttpConnection *client;
+		uint64_t since;
+	};
+
+	Mutex mutex;
+	std::map<String, std::vector<IdleClient>> idle;
+
+	const uint64_t idle_timeout;
+	const uint64_t max_idle_per_host;
+
+	HttpReactor reactor;
+
+public:
+	/**
+	 * Take a connection to `p_host` out of the pool.
+	 *
+	 * @param[in] p_host Scheme and host, as passed to `HttpConnection::connect_to_host`.
+	 * @returns A client still connected to `p_host`, or a new disconnected client that the caller must connect.
+	 */
+	HttpConnection *acquire(const String p_host);
+
+	/**
+	 * Give a client back to the pool. It is only kept if it is connected and has no response left to read.
+	 *
+	 * @param[in] p_host The host the client was acquired for.
+	 * @param[in] p_client The client, which must not be used by the caller anymore.
+	 */
+	void release(const String p_host, HttpConnection *const p_client);
+
+	HttpReactor &get_reactor();
+
+	/**
+	 * @param[in] p_idle_timeout Milliseconds after which an idle connection is assumed to be closed by the server.
+	 * @param[in] p_max_idle_per_host Maximum number of idle connections kept for each host.
+	 */
+	HttpPool(const uint64_t p_idle_timeout = 10000, const uint64_t p_max_idle_per_host = 4);
+	~HttpPool();
+};
+
+/**
+ * Connection borrowed from an `HttpPool` for the lifetime of this object.
+ */
+class PooledClient {
+	HttpPool &pool;
+	const String host;
+
+public:
+	HttpConnection *const client;
+
+	PooledClient(HttpPool &p_pool, const String p_host);
+	~PooledClient();
+};
@@ -0,0 +1,103 @@
+#include "http_reactor.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+void HttpReactor::_thread_func() {
+	// Time to sleep after a pass without progress, doubled on every idle pass.
+	static const uint64_t MIN_DELAY_USEC = 50;
+	static const uint64_t MAX_DELAY_USEC = 5000;
+
+	uint64_t delay = MIN_DELAY_USEC;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!terminate_thread) {
+		if (jobs.empty()) {
+			condition.wait(lock, [&]() { return terminate_thread || !jobs.empty(); });
+			delay = MIN_DELAY_USEC;
+			continue;
+		}
+
+		// Jobs may be added while the pass runs, they get their turn in the next one.
+		const std::vector<Job *> pass = jobs;
+		lock.unlock();
+
+		bool progress = false;
+		std::vector<Job *> completed;
+		for (Job *const job : pass) {
+			switch ((*job->step)()) {
+				case STEP_IDLE: {
+				} break;
+				case STEP_PROGRESS: {
+					progress = true;
+				} break;
+				case STEP_DONE: {
+					completed.push_back(job);
+					progress = true;
+				} break;
+			}
+		}
+
+		lock.lock();
+
+		// Waiting threads read `done` under the lock.
+		for (Job *const job : completed) {
+			job->done = true;
+		}
+
+		const std::vector<Job *>::iterator finished = std::remove_if(jobs.begin(), jobs.end(), [](const Job *const p_job) {
+			return p_job->done;
+		});
+		if (finished != jobs.end()) {
+			jobs.erase(finished, jobs.end());
+			done_condition.notify_all();
+		}
+
+		if (progress) {
+			delay = MIN_DELAY_USEC;
+			continue;
+		}
+
+		// A new job wakes the thread up early.
+		const size_t job_count = jobs.size();
+		condition.wait_for(lock, std::chrono::microseconds(delay), [&]() {
+			return terminate_thread || jobs.size() != job_count;
+		});
+		delay = std::min(delay * 2, MAX_DELAY_USEC);
+	}
+
+	// Release everyone still waiting.
+	for (Job *const job : jobs) {
+		job->done = true;
+	}
+	jobs.clear();
+	done_condition.notify_all();
+}
+
+void HttpReactor::run(const Step &p_step) {
+	Job job;
+	job.step = &p_step;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (terminate_thread) {
+		return;
+	}
+
+	jobs.push_back(&job);
+	condition.notify_one();
+
+	done_condition.wait(lock, [&]() { return job.done; });
+}
+
+HttpReactor::HttpReactor() {
+	thread = std::thread(&HttpReactor::_thread_func, this);
+}
+
+HttpReactor::~HttpReactor() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		terminate_thread = true;
+	}
+	condition.notify_all();
+	thread.join();
+}
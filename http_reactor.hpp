@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Single thread that drives every HTTP transfer, while the threads waiting for them sleep.
+ *
+ * Godot's `HTTPClient` does not expose its socket, so the reactor cannot wait on epoll. Instead every pending transfer
+ * is stepped in one loop, and the loop backs off exponentially while no transfer makes progress. This costs one thread
+ * in total instead of one spinning core per transfer.
+ */
+class HttpReactor {
+public:
+	enum StepResult {
+		STEP_IDLE,
+		STEP_PROGRESS,
+		STEP_DONE
+	};
+
+	/**
+	 * Advances a transfer without blocking. Runs on the reactor thread.
+	 */
+	typedef std::function<StepResult()> Step;
+
+private:
+	struct Job {
+		const Step *step;
+		bool done = false;
+	};
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::condition_variable done_condition;
+
+	std::vector<Job *> jobs;
+	bool terminate_thread = false;
+
+	void _thread_func();
+
+public:
+	/**
+	 * Call `p_step` on the reactor thread until it returns `STEP_DONE`, blocking the calling thread until then.
+	 *
+	 * The step may freely use state of the calling thread, since that thread is waiting. If the reactor is destroyed
+	 * first, this returns without the step having finished.
+	 *
+	 * @param[in] p_step The step, which must not block.
+	 */
+	void run(const Step &p_step);
+
+	HttpReactor();
+	~HttpReactor();
+};
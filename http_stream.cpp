@@ -1,171 +1,906 @@
 #include "http_stream.hpp"
 
+#include "core/os/os.h"
+
 #include <iostream>
+#include <utility>
 
-void HttpStream::_poll_request() {
-	if (!has_parsed) {
-		{
-			int port;
-			const Error err = url.parse_url(scheme, host, port, path);
-			if (err != OK) {
-				ERR_FAIL_MSG("Failed to parse URL.");
-			}
-		}
+HttpStream::RequestStatus HttpStream::_update_request(Request &p_request, bool &r_progress) {
+	// Give up on a request after this many connection errors in a row.
+	static const uint64_t MAX_FAILURES = 3;
 
-		has_parsed = true;
+	if (p_request.client == nullptr) {
+		p_request.client_host = scheme + host;
+		p_request.client = pool->acquire(p_request.client_host);
 	}
-	while (true) {
-		if (has_content_length && cache_pos >= content_length) {
-			ERR_FAIL_MSG("Request position out of bounds.");
-		}
-		HTTPClient::Status status = client.get_status();
-		switch (status) {
-			case HTTPClient::STATUS_DISCONNECTED: {
-				Error err = client.connect_to_host(scheme + host);
-				if (err != OK) {
-					ERR_FAIL_MSG("Failed to connect to host.");
-				}
-			} break;
-			case HTTPClient::STATUS_RESOLVING: {
-				OS::get_singleton()->delay_usec(1);
-				client.poll();
-			} break;
-			case HTTPClient::STATUS_CANT_RESOLVE: {
-				ERR_FAIL_MSG("Cannot resolve host.");
-			} break;
-			case HTTPClient::STATUS_CONNECTING: {
-				OS::get_singleton()->delay_usec(1);
-				client.poll();
-			} break;
-			case HTTPClient::STATUS_CANT_CONNECT: {
-				ERR_FAIL_MSG("Cannot connect.");
-			} break;
-			case HTTPClient::STATUS_CONNECTED: {
-				Vector<String> headers;
-				headers.push_back(vformat("Range: bytes=%s-", cache_pos + cache_buffer.size()));
-				Error err = client.request(HTTPClient::Method::METHOD_GET, path, headers);
-				if (err != OK) {
-					ERR_FAIL_MSG("Failed to read from server.");
-				}
-			} break;
-			case HTTPClient::STATUS_REQUESTING: {
-				OS::get_singleton()->delay_usec(1);
-				client.poll();
-			} break;
-			case HTTPClient::STATUS_BODY: {
-				if (client.get_response_body_length() == 0) {
-					List<String> headers;
-					const Error headers_err = client.get_response_headers(&headers);
-					if (headers_err != OK) {
-						ERR_FAIL_MSG("Failed to read headers.");
-					}
+	HttpConnection *const client = p_request.client;
 
-					String redirect;
-					for (int i = 0; i < headers.size(); ++i) {
-						const String header = headers[i];
-						if (header.begins_with("Location: ")) {
-							redirect = header.substr(10);
-							client.close();
-							break;
-						}
-					}
+	switch (client->get_status()) {
+		case HttpConnection::STATUS_DISCONNECTED: {
+			// The server may close the connection after a response that ran to the end of the file.
+			if (p_request.sent && p_request.end == 0 && has_content_length && p_request.pos >= content_length) {
+				return REQUEST_DONE;
+			}
+
+			p_request.sent = false;
+			const Error err = client->connect_to_host(p_request.client_host);
+			if (err != OK) {
+				ERR_FAIL_V_MSG(REQUEST_FAILED, "Failed to connect to host.");
+			}
+		} break;
+		case HttpConnection::STATUS_RESOLVING:
+		case HttpConnection::STATUS_CONNECTING:
+		case HttpConnection::STATUS_REQUESTING: {
+			client->poll();
+		} break;
+		case HttpConnection::STATUS_CANT_RESOLVE: {
+			ERR_FAIL_V_MSG(REQUEST_FAILED, "Cannot resolve host.");
+		} break;
+		case HttpConnection::STATUS_CANT_CONNECT: {
+			ERR_FAIL_V_MSG(REQUEST_FAILED, "Cannot connect.");
+		} break;
+		case HttpConnection::STATUS_CONNECTED: {
+			// The response is over. A bounded response that ended early is requested again from where it stopped.
+			if (p_request.sent && (p_request.end == 0 || p_request.pos >= p_request.end)) {
+				return REQUEST_DONE;
+			}
+
+			Vector<String> headers;
+			if (p_request.end != 0) {
+				headers.push_back(vformat("Range: bytes=%s-%s", p_request.pos, p_request.end - 1));
+			} else {
+				headers.push_back(vformat("Range: bytes=%s-", p_request.pos));
+			}
+			const Error err = client->request(HttpConnection::METHOD_GET, path, headers);
+			if (err != OK) {
+				ERR_FAIL_V_MSG(REQUEST_FAILED, "Failed to read from server.");
+			}
 
-					if(redirect.empty()) {
-						for(int i = 0; i < headers.size(); ++i) {
+			p_request.sent = true;
+			p_request.sent_usec = download_usec;
+			p_request.has_headers = false;
+		} break;
+		case HttpConnection::STATUS_BODY: {
+			if (!p_request.has_headers) {
+				const int code = client->get_response_code();
+				if (code / 100 == 3) {
+					String redirect = client->get_response_location();
+					if (redirect.empty()) {
+						List<String> headers;
+						client->get_response_headers(&headers);
+						for (int i = 0; i < headers.size(); ++i) {
 							print_error(headers[i]);
 						}
-						ERR_FAIL_MSG("No redirect header given.");
+						ERR_FAIL_V_MSG(REQUEST_FAILED, "No redirect header given.");
 					}
 
 					if (redirect.begins_with("//")) {
 						redirect = redirect.insert(0, "https:");
 					} else if (redirect.begins_with("/")) {
-						redirect = redirect.insert(0, host);
+						redirect = redirect.insert(0, scheme + host);
 					}
 
 					int port;
 					const Error url_err = redirect.parse_url(scheme, host, port, path);
 					if (url_err != OK) {
-						ERR_FAIL_MSG("Failed to parse redirect url.");
+						ERR_FAIL_V_MSG(REQUEST_FAILED, "Failed to parse redirect url.");
 					}
 
-					if (!redirect.empty()) {
-						continue;
+					// Finish an empty body so that the connection can be kept, then continue on the new host.
+					if (client->get_response_body_length() == 0) {
+						uint8_t none;
+						client->read_body(&none, 0);
 					}
+					pool->release(p_request.client_host, client);
+					p_request.client = nullptr;
+					p_request.sent = false;
+					return REQUEST_ACTIVE;
+				}
 
-					ERR_FAIL_MSG("Response body length was zero.");
+				// A server that ignores the range sends the file from the start, which cannot be used here.
+				if (code != 206 && !(code == 200 && p_request.pos == 0)) {
+					ERR_FAIL_V_MSG(REQUEST_FAILED, vformat("Unexpected response code %d.", code));
 				}
 
-				if (!has_content_length) {
+				// Prefer the total size from "Content-Range: bytes 0-99/1234", since the request may be bounded.
+				if (!has_content_length && client->get_response_total_length() >= 0) {
 					has_content_length = true;
-					content_length = cache_pos + client.get_response_body_length();
+					content_length = client->get_response_total_length();
+				}
+
+				if (!has_content_length && client->get_response_body_length() >= 0) {
+					has_content_length = true;
+					content_length = p_request.pos + client->get_response_body_length();
+				}
+
+				if (disk_cache && has_content_length) {
+					disk_cache->set_length(content_length);
 				}
 
-				OS::get_singleton()->delay_usec(1);
-				client.poll();
+				estimator->add_latency(download_usec - p_request.sent_usec);
+
+				p_request.has_headers = true;
+				p_request.progress_usec = download_usec;
+				p_request.rate_since_usec = download_usec;
+				p_request.rate_bytes = 0;
+			}
+
+			// A request racing another one skips what the other one delivered already.
+			const std::map<uint64_t, CacheRange>::iterator own = cache.find(p_request.start);
+			const uint64_t frontier = own != cache.end() ? own->first + own->second.data.get_size() : p_request.start;
+			if (p_request.pos < frontier) {
+				uint8_t skipped[16384];
+				const uint64_t size = client->read_body(skipped, MIN((uint64_t)sizeof(skipped), frontier - p_request.pos));
+				if (size == 0) {
+					break;
+				}
+
+				p_request.pos += size;
+				p_request.progress_usec = download_usec;
+				p_request.rate_bytes += size;
+				r_progress = true;
+				break;
+			}
+
+			// Never grow past the request or into a range that was cached by someone else in the meantime.
+			uint64_t limit = p_request.end != 0 ? p_request.end - p_request.pos : UINT64_MAX;
+			const std::map<uint64_t, CacheRange>::iterator next = cache.upper_bound(p_request.pos);
+			if (next != cache.end()) {
+				limit = MIN(limit, next->first - p_request.pos);
+			}
+			if (limit == 0) {
+				p_request.end = p_request.pos;
+				return REQUEST_DONE;
+			}
 
-				return;
-			} break;
-			case HTTPClient::STATUS_CONNECTION_ERROR: {
-				client.close();
-			} break;
-			default: {
-				ERR_FAIL_MSG("Invalid connection status.");
-			} break;
+			// Receive straight into the cached range, which must not be left behind empty.
+			std::map<uint64_t, CacheRange>::iterator range = cache.find(p_request.start);
+			const bool created = range == cache.end();
+			if (created) {
+				range = cache.emplace(p_request.start, CacheRange()).first;
+			}
+
+			uint64_t writable;
+			uint8_t *const buffer = range->second.data.begin_write(writable);
+			const uint64_t size = client->read_body(buffer, MIN(writable, limit));
+			if (size == 0) {
+				if (created) {
+					cache.erase(range);
+				}
+				break;
+			}
+
+			range->second.data.commit_write(size);
+			range->second.last_access = ++access_count;
+
+			if (disk_cache) {
+				unwritten.push_back(std::make_pair(p_request.pos, size));
+			}
+
+			p_request.pos += size;
+			p_request.failures = 0;
+			p_request.progress_usec = download_usec;
+			p_request.rate_bytes += size;
+			if (p_request.race != 0) {
+				p_request.race_bytes += size;
+			}
+			cache_size += size;
+			rate_window_bytes += size;
+			received_bytes += size;
+			r_progress = true;
+
+			if (p_request.end != 0 && p_request.pos >= p_request.end) {
+				return REQUEST_DONE;
+			}
+		} break;
+		case HttpConnection::STATUS_CONNECTION_ERROR: {
+			client->close();
+			p_request.sent = false;
+			if (++p_request.failures >= MAX_FAILURES) {
+				ERR_FAIL_V_MSG(REQUEST_FAILED, "Connection failed.");
+			}
+		} break;
+		default: {
+			ERR_FAIL_V_MSG(REQUEST_FAILED, "Invalid connection status.");
+		} break;
+	}
+
+	return REQUEST_ACTIVE;
+}
+
+uint64_t HttpStream::_start_request(const uint64_t p_pos, const uint64_t p_end) {
+	Request request;
+	request.pos = p_pos;
+	request.progress_usec = download_usec;
+
+	// Continue the range that ends right before this position, if nothing else is appending to it.
+	request.start = p_pos;
+	if (p_pos > 0) {
+		const std::map<uint64_t, CacheRange>::iterator previous = _find_range(p_pos - 1);
+		if (previous != cache.end() && !_is_receiving(previous->first)) {
+			request.start = previous->first;
 		}
 	}
+
+	// Only request the gap up to the next byte we already have or asked for.
+	const std::map<uint64_t, CacheRange>::iterator next = cache.upper_bound(p_pos);
+	uint64_t end = next != cache.end() ? next->first : 0;
+	for (const Request &other : requests) {
+		if (other.pos > p_pos && (end == 0 || other.pos < end)) {
+			end = other.pos;
+		}
+	}
+
+	if (chunk_size != 0) {
+		end = end == 0 ? p_pos + chunk_size : MIN(end, p_pos + chunk_size);
+		if (has_content_length) {
+			end = MIN(end, content_length);
+		}
+	}
+	if (p_end != 0) {
+		end = end == 0 ? p_end : MIN(end, p_end);
+	}
+
+	request.end = end;
+	requests.push_back(request);
+	return end;
 }
 
-void HttpStream::read(uint8_t *const p_buffer, uint64_t &p_pos, const uint64_t p_bytes) {
-	// If keeping the old request would involve receiving more than 50KB, make a new request.
+void HttpStream::_cancel_request(const size_t p_index) {
+	// Finish an unwanted bounded response instead of dropping its connection if only this much is left of it.
+	static const uint64_t DRAIN_IF_LEFT = 65536;
+
+	Request &request = requests[p_index];
+	if (request.sent && request.end != 0 && request.end - request.pos <= DRAIN_IF_LEFT) {
+		// Receiving the rest is cheaper than a new handshake, and the bytes end up cached anyway. The request keeps
+		// being advanced, but no longer counts as in flight.
+		request.cancelled = true;
+		return;
+	}
+
+	// A connection that is still receiving cannot be reused, so the pool drops it.
+	_remove_request(p_index);
+}
+
+uint64_t HttpStream::_count_in_flight() const {
+	uint64_t count = 0;
+	for (const Request &request : requests) {
+		if (!request.cancelled && !request.hedge) {
+			++count;
+		}
+	}
+	return count;
+}
+
+void HttpStream::_remove_request(const size_t p_index) {
+	pool->release(requests[p_index].client_host, requests[p_index].client);
+	requests.erase(requests.begin() + p_index);
+}
+
+bool HttpStream::_is_receiving(const uint64_t p_start) const {
+	for (const Request &request : requests) {
+		if (request.start == p_start) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool HttpStream::_check_stall(Request &p_request) {
+	// A request that delivers nothing for this long is stalled, including the wait for the response.
+	static const uint64_t PROGRESS_DEADLINE_USEC = 2000000;
+	// Throughput below this is stalled as well. It is above the bitrate of any audio format, so a request this slow
+	// cannot keep playback going.
+	static const uint64_t THROUGHPUT_FLOOR = 24000;
+	static const uint64_t FLOOR_WINDOW_USEC = 2000000;
+
+	if (download_usec - p_request.progress_usec >= PROGRESS_DEADLINE_USEC) {
+		return true;
+	}
+
+	if (!p_request.has_headers || download_usec - p_request.rate_since_usec < FLOOR_WINDOW_USEC) {
+		return false;
+	}
+
+	const uint64_t rate = p_request.rate_bytes * 1000000 / (download_usec - p_request.rate_since_usec);
+	p_request.rate_since_usec = download_usec;
+	p_request.rate_bytes = 0;
+	return rate < THROUGHPUT_FLOOR;
+}
+
+void HttpStream::_hedge_stalled(const uint64_t p_pos) {
+	for (size_t i = 0; i < requests.size(); ++i) {
+		Request &request = requests[i];
+		const bool covers = request.pos <= p_pos && (request.end == 0 || p_pos < request.end);
+		if (!covers || request.cancelled || !_check_stall(request)) {
+			continue;
+		}
+
+		if (request.race != 0) {
+			// Already racing, so give up on whichever racer went the longest without delivering. If the other one
+			// is stalled as well, it gets a new duplicate soon.
+			size_t slowest = i;
+			for (size_t j = 0; j < requests.size(); ++j) {
+				if (requests[j].race == request.race && requests[j].progress_usec < requests[slowest].progress_usec) {
+					slowest = j;
+				}
+			}
+			_remove_request(slowest);
+			return;
+		}
+
+		Request hedge;
+		hedge.start = request.start;
+		hedge.pos = request.pos;
+		hedge.end = request.end;
+		hedge.progress_usec = download_usec;
+		hedge.hedge = true;
+		hedge.race = ++race_count;
+
+		request.race = hedge.race;
+		request.race_bytes = 0;
+		requests.push_back(hedge);
+		return;
+	}
+}
+
+void HttpStream::_settle_races() {
+	// A racer wins once it delivered this much, and the others are dropped.
+	static const uint64_t WIN_BYTES = 32768;
+
+	for (size_t i = requests.size(); i-- > 0;) {
+		const Request &request = requests[i];
+
+		bool lost = false;
+		for (const Request &other : requests) {
+			if (request.race != 0 && &other != &request && other.race == request.race && other.race_bytes >= WIN_BYTES && other.race_bytes > request.race_bytes) {
+				lost = true;
+			}
+		}
+
+		// Everything it would deliver is already cached, which happens when another racer finished first.
+		const uint64_t end = request.end != 0 ? request.end : (has_content_length ? content_length : 0);
+		const std::map<uint64_t, CacheRange>::iterator range = _find_range(request.pos);
+		const bool useless = request.race != 0 && end != 0 && range != cache.end() && range->first + range->second.data.get_size() >= end;
+
+		if (lost || useless) {
+			_remove_request(i);
+		}
+	}
+
+	// The last one left in a race carries on as a normal request.
+	for (Request &request : requests) {
+		if (request.race == 0) {
+			continue;
+		}
+
+		bool alone = true;
+		for (const Request &other : requests) {
+			if (&other != &request && other.race == request.race) {
+				alone = false;
+			}
+		}
+		if (alone) {
+			request.race = 0;
+			request.race_bytes = 0;
+			request.hedge = false;
+		}
+	}
+}
+
+void HttpStream::_schedule(const uint64_t p_pos, const uint64_t p_end) {
+	// If keeping a request would involve receiving more than 50KB before reaching `p_pos`, make a new request.
 	static const uint64_t RESET_IF_AHEAD_BY = 50000;
 
-	// If the cache is more than 10MB behind, trim it.
-	static const uint64_t TRIM_CACHE_AFTER = 10000000;
+	// A cancelled request only has a few bytes left, so it is worth waiting for as well.
+	bool served = false;
+	for (const Request &request : requests) {
+		const bool covers = request.pos <= p_pos && (request.end == 0 || p_pos < request.end);
+		if (covers && (request.cancelled || p_pos - request.pos <= RESET_IF_AHEAD_BY)) {
+			served = true;
+		}
+	}
+
+	const uint64_t horizon = p_pos + chunk_size * in_flight;
+
+	if (!served) {
+		// A request that would deliver `p_pos` too late has to go, since the new request would overlap it. Requests
+		// outside of the read ahead also make room for it.
+		for (size_t i = requests.size(); i-- > 0;) {
+			const Request &request = requests[i];
+			if (request.cancelled) {
+				continue;
+			}
+
+			const bool covers = request.pos <= p_pos && (request.end == 0 || p_pos < request.end);
+			const bool outside = request.pos < p_pos || request.pos >= horizon;
+			if (covers || (_count_in_flight() >= in_flight && outside)) {
+				_cancel_request(i);
+			}
+		}
 
-	int64_t offset = p_pos - cache_pos;
-	if (offset < 0 || offset - int64_t(cache_buffer.size()) > int64_t(RESET_IF_AHEAD_BY)) {
-		// Start the request from scratch.
-		client.close();
-		cache_pos = p_pos;
-		cache_buffer.resize(0);
-		offset = 0;
+		// Still full of requests ahead, so give up the furthest one.
+		while (_count_in_flight() >= in_flight) {
+			size_t furthest = requests.size();
+			for (size_t i = 0; i < requests.size(); ++i) {
+				if (!requests[i].cancelled && !requests[i].hedge && (furthest == requests.size() || requests[i].pos > requests[furthest].pos)) {
+					furthest = i;
+				}
+			}
+			_cancel_request(furthest);
+		}
 	}
 
-	// Fill up the buffer using content from the request.
-	while (uint64_t(cache_buffer.size()) < offset + p_bytes) {
-		if (client.get_status() != HTTPClient::STATUS_BODY) {
-			_poll_request();
+	// Walk forward from `p_pos`, requesting every gap until enough requests are in flight.
+	uint64_t pos = p_pos;
+	while (_count_in_flight() < in_flight) {
+		if ((p_end != 0 && pos >= p_end) || (has_content_length && pos >= content_length)) {
+			break;
+		}
+		if (pos != p_pos && (!has_content_length || pos >= horizon)) {
+			break;
+		}
+
+		const std::map<uint64_t, CacheRange>::iterator range = _find_range(pos);
+		if (range != cache.end()) {
+			pos = range->first + range->second.data.get_size();
+			continue;
+		}
+
+		const Request *covering = nullptr;
+		for (const Request &request : requests) {
+			if (request.pos <= pos && (request.end == 0 || pos < request.end)) {
+				covering = &request;
+			}
+		}
+		if (covering != nullptr) {
+			if (covering->end == 0) {
+				break;
+			}
+			pos = covering->end;
+			continue;
+		}
+
+		pos = _start_request(pos, p_end);
+		if (pos == 0) {
+			break;
 		}
-		const PoolByteArray &chunk = client.read_response_body_chunk();
-		cache_buffer.append_array(chunk);
 	}
+}
+
+void HttpStream::_adapt_in_flight(const bool p_failed) {
+	// Amount of downloading time throughput is measured over before deciding whether more connections help.
+	static const uint64_t RATE_WINDOW_USEC = 1000000;
 
-	// Copy data from cache to input buffer.
-	for (uint64_t i = 0; i < p_bytes; ++i) {
-		p_buffer[i] = cache_buffer[offset + i];
+	if (chunk_size == 0) {
+		return;
 	}
 
-	const int64_t trim_amount = offset - TRIM_CACHE_AFTER;
-	if (trim_amount > 0) {
-		cache_buffer = cache_buffer.subarray(trim_amount, -1);
+	if (p_failed) {
+		in_flight = MAX(in_flight / 2, (uint64_t)1);
+		rate_window_usec = 0;
+		rate_window_bytes = 0;
+		return;
+	}
+
+	if (rate_window_usec < RATE_WINDOW_USEC) {
+		return;
+	}
+
+	const double rate = rate_window_bytes * 1000000.0 / rate_window_usec;
+	if (rate > last_rate * 1.1) {
+		in_flight = MIN(in_flight + 1, max_in_flight);
+	} else if (rate < last_rate * 0.9 && in_flight > 1) {
+		--in_flight;
+	}
+
+	last_rate = rate;
+	rate_window_usec = 0;
+	rate_window_bytes = 0;
+}
+
+uint64_t HttpStream::_find_missing(const uint64_t p_pos, const uint64_t p_end) {
+	uint64_t pos = p_pos;
+	while (pos < p_end) {
+		const std::map<uint64_t, CacheRange>::iterator range = _find_range(pos);
+		if (range == cache.end()) {
+			return pos;
+		}
+		pos = range->first + range->second.data.get_size();
+	}
+	return p_end;
+}
+
+bool HttpStream::_parse_url() {
+	if (!has_parsed) {
+		int port;
+		if (url.parse_url(scheme, host, port, path) != OK) {
+			return false;
+		}
+
+		has_parsed = true;
+	}
+	return true;
+}
+
+std::map<uint64_t, HttpStream::CacheRange>::iterator HttpStream::_find_range(const uint64_t p_pos) {
+	std::map<uint64_t, CacheRange>::iterator range = cache.upper_bound(p_pos);
+	if (range == cache.begin()) {
+		return cache.end();
+	}
+
+	--range;
+	if (p_pos < range->first + range->second.data.get_size()) {
+		return range;
+	}
+	return cache.end();
+}
+
+void HttpStream::_download(const uint64_t p_pos, const uint64_t p_end) {
+	// Give up after this many failed requests in a row.
+	static const uint64_t MAX_FAILURES = 3;
+
+	if (!_parse_url()) {
+		ERR_FAIL_MSG("Failed to parse URL.");
+	}
+
+	if (has_content_length && p_pos >= content_length) {
+		ERR_FAIL_MSG("Request position out of bounds.");
+	}
+
+	// The requests are advanced on the reactor thread while this thread sleeps, so nothing else touches the stream.
+	uint64_t failures = 0;
+	String error;
+	uint64_t last_step = OS::get_singleton()->get_ticks_usec();
+	const HttpReactor::Step step = [&]() -> HttpReactor::StepResult {
+		const uint64_t now = OS::get_singleton()->get_ticks_usec();
+		download_usec += now - last_step;
+		last_step = now;
+
+		if (_find_range(p_pos) != cache.end() || (cancel != nullptr && *cancel)) {
+			return HttpReactor::STEP_DONE;
+		}
+
+		_schedule(p_pos, p_end);
+		_hedge_stalled(p_pos);
+		if (requests.empty()) {
+			error = "Failed to request data.";
+			return HttpReactor::STEP_DONE;
+		}
+
+		bool progress = false;
+		for (size_t i = 0; i < requests.size();) {
+			const RequestStatus status = _update_request(requests[i], progress);
+			if (status == REQUEST_ACTIVE) {
+				++i;
+				continue;
+			}
+
+			_remove_request(i);
+			if (status == REQUEST_FAILED) {
+				_adapt_in_flight(true);
+				if (++failures >= MAX_FAILURES) {
+					error = "Failed to request data.";
+					return HttpReactor::STEP_DONE;
+				}
+			}
+		}
+		_settle_races();
+
+		if (_find_range(p_pos) != cache.end()) {
+			return HttpReactor::STEP_DONE;
+		}
+		return progress ? HttpReactor::STEP_PROGRESS : HttpReactor::STEP_IDLE;
+	};
+
+	const uint64_t start = OS::get_singleton()->get_ticks_usec();
+	const uint64_t received_before = received_bytes;
+	pool->get_reactor().run(step);
+	const uint64_t elapsed = OS::get_singleton()->get_ticks_usec() - start;
+	rate_window_usec += elapsed;
+	estimator->add_transfer(received_bytes - received_before, elapsed);
+
+	_write_disk_cache();
+
+	if (!error.empty()) {
+		ERR_FAIL_MSG(error);
+	}
+
+	_adapt_in_flight(false);
+	_trim_cache(p_pos);
+}
+
+void HttpStream::_write_disk_cache() {
+	if (!disk_cache) {
+		unwritten.clear();
+		return;
+	}
+
+	for (const std::pair<uint64_t, uint64_t> &piece : unwritten) {
+		const std::map<uint64_t, CacheRange>::iterator range = _find_range(piece.first);
+		if (range == cache.end()) {
+			continue;
+		}
+
+		// Every piece was received into one contiguous span of its range.
+		const uint8_t *const data = range->second.data.span(piece.first - range->first, piece.second);
+		if (data != nullptr) {
+			disk_cache->write(piece.first, data, piece.second);
+		}
+	}
+	unwritten.clear();
+}
+
+void HttpStream::_trim_cache(const uint64_t p_pos) {
+	while (cache_size > cache_budget) {
+		const std::map<uint64_t, CacheRange>::iterator current = _find_range(p_pos);
+
+		// Evict the least recently used range that is neither being read nor downloaded into.
+		std::map<uint64_t, CacheRange>::iterator victim = cache.end();
+		for (std::map<uint64_t, CacheRange>::iterator it = cache.begin(); it != cache.end(); ++it) {
+			if (it == current || _is_receiving(it->first)) {
+				continue;
+			}
+			if (victim == cache.end() || it->second.last_access < victim->second.last_access) {
+				victim = it;
+			}
+		}
+
+		if (victim != cache.end()) {
+			cache_size -= victim->second.data.get_size();
+			cache.erase(victim);
+			continue;
+		}
+
+		// Only the range being read is left, so drop the part of it that is behind the read position.
+		if (current == cache.end()) {
+			break;
+		}
+
+		const uint64_t trim_amount = MIN(cache_size - cache_budget, p_pos - current->first);
+		if (trim_amount == 0) {
+			break;
+		}
+
+		// Only whole segments are released, the remaining bytes stay where they are.
+		CacheRange trimmed;
+		trimmed.data = std::move(current->second.data);
+		trimmed.data.trim_front(trim_amount);
+		trimmed.last_access = current->second.last_access;
+
+		const uint64_t start = current->first + trim_amount;
+		for (Request &request : requests) {
+			if (request.start == current->first) {
+				request.start = start;
+			}
+		}
+
+		cache.erase(current);
+		cache[start] = std::move(trimmed);
+		cache_size -= trim_amount;
+	}
+}
+
+void HttpStream::set_cache_budget(const uint64_t p_bytes) {
+	cache_budget = p_bytes;
+}
+
+uint64_t HttpStream::get_cache_budget() const {
+	return cache_budget;
+}
+
+void HttpStream::set_parallel(const uint64_t p_chunk_size, const uint64_t p_max_connections) {
+	chunk_size = p_chunk_size;
+	max_in_flight = chunk_size != 0 ? MAX(p_max_connections, (uint64_t)1) : 1;
+	in_flight = MIN(max_in_flight, (uint64_t)2);
+	last_rate = 0.0;
+	rate_window_usec = 0;
+	rate_window_bytes = 0;
+}
+
+void HttpStream::set_disk_cache(const std::shared_ptr<CacheFile> &p_file) {
+	disk_cache = p_file;
+	if (disk_cache && has_content_length) {
+		disk_cache->set_length(content_length);
+	}
+}
+
+void HttpStream::set_cancel_flag(const bool *const p_cancel) {
+	cancel = p_cancel;
+}
+
+void HttpStream::set_estimator(const std::shared_ptr<BandwidthEstimator> &p_estimator) {
+	estimator = p_estimator ? p_estimator : std::make_shared<BandwidthEstimator>();
+}
+
+void HttpStream::read(uint8_t *const p_buffer, uint64_t &p_pos, const uint64_t p_bytes) {
+	// The bytes may be spread across several ranges, so copy them piece by piece.
+	for (uint64_t done = 0; done < p_bytes;) {
+		const uint64_t pos = p_pos + done;
+
+		std::map<uint64_t, CacheRange>::iterator range = _find_range(pos);
+		if (range == cache.end()) {
+			_download(pos);
+			range = _find_range(pos);
+		}
+
+		if (range == cache.end()) {
+			for (uint64_t i = done; i < p_bytes; ++i) {
+				p_buffer[i] = 0;
+			}
+			ERR_FAIL_MSG("Failed to download data.");
+		}
+
+		const uint64_t offset = pos - range->first;
+		const uint64_t copy = MIN(p_bytes - done, range->second.data.get_size() - offset);
+		range->second.data.copy(offset, p_buffer + done, copy);
+		range->second.last_access = ++access_count;
+
+		done += copy;
 	}
 
 	// Since the read was successful, move the position.
 	p_pos += p_bytes;
 }
 
+const uint8_t *HttpStream::window(const uint64_t p_pos, const uint64_t p_bytes) {
+	std::map<uint64_t, CacheRange>::iterator range = _find_range(p_pos);
+	if (range == cache.end()) {
+		_download(p_pos);
+		range = _find_range(p_pos);
+		if (range == cache.end()) {
+			return nullptr;
+		}
+	}
+
+	// Keep extending this range while its end is not cached anywhere else.
+	while (p_pos + p_bytes > range->first + range->second.data.get_size()) {
+		const uint64_t end = range->first + range->second.data.get_size();
+		if (_find_range(end) != cache.end()) {
+			return nullptr;
+		}
+
+		_download(end);
+
+		range = _find_range(p_pos);
+		if (range == cache.end() || range->first + range->second.data.get_size() <= end) {
+			return nullptr;
+		}
+	}
+
+	range->second.last_access = ++access_count;
+
+	// Null if the bytes straddle two segments, in which case the caller falls back to `read`.
+	return range->second.data.span(p_pos - range->first, p_bytes);
+}
+
+bool HttpStream::preload(const uint64_t p_start, const uint64_t p_end) {
+	for (uint64_t pos = _find_missing(p_start, p_end); pos < p_end; pos = _find_missing(pos, p_end)) {
+		_download(pos, p_end);
+		if (cancel != nullptr && *cancel) {
+			return false;
+		}
+		if (_find_range(pos) == cache.end()) {
+			ERR_FAIL_V_MSG(false, "Failed to preload data.");
+		}
+	}
+
+	return true;
+}
+
+void HttpStream::load_ranges(const std::vector<std::pair<uint64_t, uint64_t>> &p_ranges) {
+	// Give up after this many failed requests in a row.
+	static const uint64_t MAX_FAILURES = 3;
+
+	if (!_parse_url()) {
+		ERR_FAIL_MSG("Failed to parse URL.");
+	}
+
+	std::vector<std::pair<uint64_t, uint64_t>> ranges;
+	for (const std::pair<uint64_t, uint64_t> &range : p_ranges) {
+		const uint64_t end = has_content_length ? MIN(range.second, content_length) : range.second;
+		if (range.first < end) {
+			ranges.push_back(std::make_pair(range.first, end));
+		}
+	}
+
+	// Every missing range gets its own exact request, regardless of `in_flight`, since all of them are waited on.
+	uint64_t failures = 0;
+	String error;
+	uint64_t last_step = OS::get_singleton()->get_ticks_usec();
+	const HttpReactor::Step step = [&]() -> HttpReactor::StepResult {
+		const uint64_t now = OS::get_singleton()->get_ticks_usec();
+		download_usec += now - last_step;
+		last_step = now;
+
+		if (cancel != nullptr && *cancel) {
+			return HttpReactor::STEP_DONE;
+		}
+
+		bool done = true;
+		for (const std::pair<uint64_t, uint64_t> &range : ranges) {
+			const uint64_t missing = _find_missing(range.first, range.second);
+			if (missing >= range.second) {
+				continue;
+			}
+			done = false;
+
+			bool covered = false;
+			for (const Request &request : requests) {
+				if (request.pos <= missing && (request.end == 0 || missing < request.end)) {
+					covered = true;
+				}
+			}
+			if (!covered) {
+				_start_request(missing, range.second);
+			}
+		}
+		if (done) {
+			return HttpReactor::STEP_DONE;
+		}
+
+		bool progress = false;
+		for (size_t i = 0; i < requests.size();) {
+			const RequestStatus status = _update_request(requests[i], progress);
+			if (status == REQUEST_ACTIVE) {
+				++i;
+				continue;
+			}
+
+			_remove_request(i);
+			if (status == REQUEST_FAILED && ++failures >= MAX_FAILURES) {
+				error = "Failed to load ranges.";
+				return HttpReactor::STEP_DONE;
+			}
+		}
+
+		return progress ? HttpReactor::STEP_PROGRESS : HttpReactor::STEP_IDLE;
+	};
+
+	const uint64_t start = OS::get_singleton()->get_ticks_usec();
+	const uint64_t received_before = received_bytes;
+	pool->get_reactor().run(step);
+	estimator->add_transfer(received_bytes - received_before, OS::get_singleton()->get_ticks_usec() - start);
+
+	_write_disk_cache();
+
+	if (!error.empty()) {
+		ERR_FAIL_MSG(error);
+	}
+}
+
+void HttpStream::set_length(const uint64_t p_length) {
+	has_content_length = true;
+	content_length = p_length;
+
+	if (disk_cache) {
+		disk_cache->set_length(content_length);
+	}
+}
+
+bool HttpStream::get_bandwidth(double &r_rate, double &r_deviation, double &r_latency) {
+	return estimator->get_estimate(r_rate, r_deviation, r_latency);
+}
+
 uint64_t HttpStream::get_length() {
 	if (!has_content_length) {
-		_poll_request();
+		// Any request reports the length, so download the first byte that is not cached yet.
+		uint64_t pos = 0;
+		for (std::map<uint64_t, CacheRange>::iterator range = _find_range(pos); range != cache.end(); range = _find_range(pos)) {
+			pos = range->first + range->second.data.get_size();
+		}
+		_download(pos);
 	}
 
 	return content_length;
 }
 
-HttpStream::HttpStream(const String p_url) :
-		url(p_url) {
+HttpStream::HttpStream(const String p_url, const uint64_t p_cache_budget, const std::shared_ptr<HttpPool> &p_pool) :
+		url(p_url), pool(p_pool ? p_pool : std::make_shared<HttpPool>()), estimator(std::make_shared<BandwidthEstimator>()), cache_budget(p_cache_budget) {
 }
 
 HttpStream::~HttpStream() {
+	for (const Request &request : requests) {
+		pool->release(request.client_host, request.client);
+	}
 }
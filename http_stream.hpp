@@ -1,10 +1,38 @@
 #pragma once
 
-#include "core/io/http_client.h"
+#include "bandwidth_estimator.hpp"
+#include "cache_file.hpp"
+#include "http_pool.hpp"
+
 #include "core/variant.h"
 #include "ebml/stream.hpp"
+#include "segment_buffer.hpp"
+
+#include <map>
+#include <memory>
+#include <vector>
 
+/**
+ * Stream of a remote file, downloaded with HTTP range requests.
+ *
+ * Downloaded bytes are kept in a sparse cache of ranges, so reading something that was downloaded before does not
+ * touch the network again. Only the gaps between cached ranges are requested, either with one open ended request or,
+ * in parallel mode, with several bounded requests on separate connections. Ranges that are known to be needed together
+ * can also be loaded at once, each with its own request. A request that stalls while it is being
+ * waited on is raced by a duplicate on a new connection, and whichever delivers first is kept.
+ *
+ * Every downloaded byte can also be written into a `CacheFile`, so playing a video fills the disk cache as a side effect.
+ * The writes happen on the reading thread, after the transfers are stepped.
+ */
 class HttpStream : public ebml::Stream {
+	/**
+	 * Contiguous block of downloaded bytes.
+	 */
+	struct CacheRange {
+		SegmentBuffer data;
+		uint64_t last_access = 0;
+	};
+
 	const String url;
 
 	bool has_parsed = false;
@@ -12,21 +40,226 @@ class HttpStream : public ebml::Stream {
 	String host;
 	String path;
 
-	HTTPClient client;
+	/**
+	 * Range request in flight on its own connection.
+	 */
+	struct Request {
+		HttpConnection *client = nullptr;
+		// Host the client was acquired for, so that it goes back to the right place in the pool.
+		String client_host;
+
+		// Key of the cached range the received bytes are appended to.
+		uint64_t start = 0;
+		// Position of the next byte to receive. `end` is zero when the request is open ended.
+		uint64_t pos = 0;
+		uint64_t end = 0;
+
+		bool sent = false;
+		bool has_headers = false;
+		uint64_t failures = 0;
+
+		// Not wanted anymore, but finished anyway to keep the connection alive.
+		bool cancelled = false;
+
+		// Stall detection, on the `download_usec` clock: when bytes last arrived, and how many arrived since the
+		// current throughput window started. The window starts with the response.
+		uint64_t sent_usec = 0;
+		uint64_t progress_usec = 0;
+		uint64_t rate_since_usec = 0;
+		uint64_t rate_bytes = 0;
+
+		// Requests racing for the same bytes share a non-zero `race`, and skip what another one already delivered.
+		// A hedge is the duplicate started for a stalled request, and does not count as in flight.
+		uint64_t race = 0;
+		uint64_t race_bytes = 0;
+		bool hedge = false;
+	};
+
+	enum RequestStatus {
+		REQUEST_ACTIVE,
+		REQUEST_DONE,
+		REQUEST_FAILED
+	};
+
+	std::shared_ptr<HttpPool> pool;
+	std::vector<Request> requests;
 
-	uint64_t cache_pos = 0;
-	PoolByteArray cache_buffer;
+	// Parallel mode splits the file into requests of `chunk_size` bytes. Zero means a single open ended request.
+	uint64_t chunk_size = 0;
+	uint64_t max_in_flight = 1;
+	uint64_t in_flight = 1;
+
+	// Time spent downloading. Requests are not advanced between downloads, so stalls are measured on this clock.
+	uint64_t download_usec = 0;
+	uint64_t race_count = 0;
+
+	// Throughput measured while downloading, used to adapt `in_flight`.
+	uint64_t rate_window_usec = 0;
+	uint64_t rate_window_bytes = 0;
+	double last_rate = 0.0;
+
+	// Fed with every download, so that readers can plan how far ahead to read.
+	std::shared_ptr<BandwidthEstimator> estimator;
+	uint64_t received_bytes = 0;
+
+	// Downloaded bytes, keyed by the position of their first byte. Ranges never overlap.
+	std::map<uint64_t, CacheRange> cache;
+	uint64_t cache_size = 0;
+	uint64_t cache_budget;
+	uint64_t access_count = 0;
 
 	bool has_content_length = false;
 	uint64_t content_length = 0;
 
+	std::shared_ptr<CacheFile> disk_cache;
+
+	// Downloads stop as soon as this is set, if it is given.
+	const bool *cancel = nullptr;
+
+	// Bytes received since the last write into the disk cache, as position and size. The reactor thread only records
+	// them, and they are written once it hands the stream back, so that disk writes never hold up other transfers.
+	std::vector<std::pair<uint64_t, uint64_t>> unwritten;
+
 protected:
-	virtual void _poll_request();
+	/**
+	 * Advance a request without blocking: connect, send, follow redirects and receive what has arrived into the cache.
+	 *
+	 * @param[in] p_request The request to advance.
+	 * @param[out] r_progress Set to true if bytes were received.
+	 */
+	RequestStatus _update_request(Request &p_request, bool &r_progress);
+
+	/**
+	 * Start a request for the gap at `p_pos`, up to the next byte that is cached or requested.
+	 *
+	 * @returns The end of the new request, zero if it is open ended.
+	 */
+	uint64_t _start_request(const uint64_t p_pos, const uint64_t p_end);
+
+	/**
+	 * Stop a request that is not wanted anymore, finishing it instead if only a few bytes are left.
+	 */
+	void _cancel_request(const size_t p_index);
+	void _remove_request(const size_t p_index);
+	uint64_t _count_in_flight() const;
+
+	/**
+	 * @returns Whether a request is appending to the cached range keyed by `p_start`.
+	 */
+	bool _is_receiving(const uint64_t p_start) const;
+
+	/**
+	 * @returns Whether a request went too long without delivering anything, or too slowly over a whole window.
+	 */
+	bool _check_stall(Request &p_request);
+
+	/**
+	 * Race a stalled request delivering `p_pos` with a duplicate from its current position on a new connection.
+	 */
+	void _hedge_stalled(const uint64_t p_pos);
+
+	/**
+	 * Drop the requests that lost a race, and those whose bytes were all delivered by another one.
+	 */
+	void _settle_races();
+
+	/**
+	 * Make sure `p_pos` is about to be delivered, and keep as many requests ahead of it in flight as allowed.
+	 */
+	void _schedule(const uint64_t p_pos, const uint64_t p_end);
+
+	/**
+	 * Add a connection while it keeps increasing throughput, and remove connections when it drops or fails.
+	 */
+	void _adapt_in_flight(const bool p_failed);
+
+	/**
+	 * @returns The first byte in [`p_pos`, `p_end`) that is not cached, or `p_end` if every byte is.
+	 */
+	uint64_t _find_missing(const uint64_t p_pos, const uint64_t p_end);
+
+	/**
+	 * @returns Whether the URL could be split into the parts requests are made with.
+	 */
+	bool _parse_url();
+
+	/**
+	 * @returns The cached range containing `p_pos`, or the end of the cache if it was not downloaded.
+	 */
+	std::map<uint64_t, CacheRange>::iterator _find_range(const uint64_t p_pos);
+
+	/**
+	 * Download until the byte at `p_pos` is cached, reusing a request if it is about to deliver it.
+	 *
+	 * New requests stop at `p_end` if it is not zero.
+	 */
+	void _download(const uint64_t p_pos, const uint64_t p_end = 0);
+
+	/**
+	 * Write the bytes received since the last call into the disk cache. Must be called before they can be evicted.
+	 */
+	void _write_disk_cache();
+
+	/**
+	 * Evict the least recently used ranges until the cache fits in its budget. The bytes at `p_pos` are kept.
+	 */
+	void _trim_cache(const uint64_t p_pos);
 
 public:
+	static const uint64_t DEFAULT_CACHE_BUDGET = 32000000;
+
+	/**
+	 * Change the maximum amount of downloaded bytes kept in memory.
+	 */
+	void set_cache_budget(const uint64_t p_bytes);
+	uint64_t get_cache_budget() const;
+
+	/**
+	 * Download with several connections at once, each fetching `p_chunk_size` bytes.
+	 *
+	 * The number of connections adapts to the measured throughput, up to `p_max_connections`.
+	 *
+	 * @param[in] p_chunk_size Bytes per request, or zero to download with a single open ended request.
+	 * @param[in] p_max_connections Maximum number of requests in flight.
+	 */
+	void set_parallel(const uint64_t p_chunk_size, const uint64_t p_max_connections);
+
+	/**
+	 * Write every byte downloaded from now on into `p_file`.
+	 */
+	void set_disk_cache(const std::shared_ptr<CacheFile> &p_file);
+
+	/**
+	 * Stop downloading as soon as `*p_cancel` is set, instead of waiting for the bytes being downloaded. The flag
+	 * must outlive the stream.
+	 */
+	void set_cancel_flag(const bool *const p_cancel);
+
+	/**
+	 * Report downloads to `p_estimator`, which may be shared with other streams.
+	 */
+	void set_estimator(const std::shared_ptr<BandwidthEstimator> &p_estimator);
+
+	/**
+	 * Download the bytes in [`p_start`, `p_end`) into the cache with exact range requests.
+	 *
+	 * Useful when the position of data that will be read soon is already known, such as the headers of a file.
+	 *
+	 * @returns Whether every byte was downloaded, which is not the case if the download was cancelled.
+	 */
+	bool preload(const uint64_t p_start, const uint64_t p_end);
+
+	/**
+	 * Set the length of the file when it is already known, so that it does not have to be requested.
+	 */
+	void set_length(const uint64_t p_length);
+
 	virtual void read(uint8_t *const p_buffer, uint64_t &p_pos, const uint64_t p_bytes);
+	virtual const uint8_t *window(const uint64_t p_pos, const uint64_t p_bytes);
+	virtual void load_ranges(const std::vector<std::pair<uint64_t, uint64_t>> &p_ranges);
+	virtual bool get_bandwidth(double &r_rate, double &r_deviation, double &r_latency);
 	virtual uint64_t get_length();
 
-	HttpStream(const String p_url);
+	HttpStream(const String p_url, const uint64_t p_cache_budget = DEFAULT_CACHE_BUDGET, const std::shared_ptr<HttpPool> &p_pool = nullptr);
 	virtual ~HttpStream();
 };
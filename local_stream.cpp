@@ -1,35 +1,151 @@
 #include "local_stream.hpp"
 
+#include "core/project_settings.h"
 #include "core/variant.h"
 
+#ifdef UNIX_ENABLED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Size of the read ahead buffer, in bytes.
+static const uint64_t READ_AHEAD_SIZE = 65536;
+
+bool LocalStream::_map() {
+#ifdef UNIX_ENABLED
+	const String global_path = ProjectSettings::get_singleton()->globalize_path(path);
+
+	const int fd = open(global_path.utf8().get_data(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+
+	void *const address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file.
+	close(fd);
+	if (address == MAP_FAILED) {
+		return false;
+	}
+
+	// Playback reads the file front to back, so ask for aggressive read ahead.
+	madvise(address, info.st_size, MADV_SEQUENTIAL);
+
+	mapping = (const uint8_t *)address;
+	length = info.st_size;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void LocalStream::_unmap() {
+#ifdef UNIX_ENABLED
+	if (mapping != nullptr) {
+		munmap((void *)mapping, length);
+		mapping = nullptr;
+	}
+#endif
+}
+
 void LocalStream::read(uint8_t *const p_buffer, uint64_t &p_pos, const uint64_t p_bytes) {
-	if (p_pos < 0 || p_pos + p_bytes > get_length()) {
+	if (p_pos < 0 || p_pos + p_bytes > length) {
 		for (uint64_t i = 0; i < p_bytes; ++i) {
 			p_buffer[i] = 0;
 		}
 		ERR_FAIL_MSG(
-				String() + "Access out of bounds: Position: " + Variant(p_pos) + ", Buffer Size: " + Variant(p_bytes) + ", Total Size: " + Variant(get_length()) + ".");
+				String() + "Access out of bounds: Position: " + Variant(p_pos) + ", Buffer Size: " + Variant(p_bytes) + ", Total Size: " + Variant(length) + ".");
 	}
 
-	file->seek(p_pos);
-	if (file->get_buffer(p_buffer, p_bytes) != p_bytes) {
-		ERR_FAIL_MSG("Could not read from file.");
+	const uint8_t *const data = window(p_pos, p_bytes);
+	if (data != nullptr) {
+		memcpy(p_buffer, data, p_bytes);
+	} else {
+		// Too large for the read ahead buffer, read it directly.
+		file->seek(p_pos);
+		if (file->get_buffer(p_buffer, p_bytes) != p_bytes) {
+			ERR_FAIL_MSG("Could not read from file.");
+		}
 	}
 
 	// Since the read was successful, move the position.
 	p_pos += p_bytes;
 }
 
+const uint8_t *LocalStream::window(const uint64_t p_pos, const uint64_t p_bytes) {
+	if (p_pos + p_bytes > length) {
+		return nullptr;
+	}
+
+	if (mapping != nullptr) {
+		return mapping + p_pos;
+	}
+
+	if (p_pos >= buffer_pos && p_pos + p_bytes <= buffer_pos + buffer_size) {
+		return buffer + (p_pos - buffer_pos);
+	}
+
+	if (p_bytes > READ_AHEAD_SIZE) {
+		return nullptr;
+	}
+
+	file->seek(p_pos);
+	buffer_pos = p_pos;
+	buffer_size = file->get_buffer(buffer, MIN(READ_AHEAD_SIZE, length - p_pos));
+	if (buffer_size < p_bytes) {
+		return nullptr;
+	}
+
+	return buffer;
+}
+
+void LocalStream::prefetch(const uint64_t p_pos, const uint64_t p_bytes) {
+#ifdef UNIX_ENABLED
+	if (mapping == nullptr || p_pos >= length) {
+		return;
+	}
+
+	// madvise needs a page aligned address.
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+	const uint64_t from = p_pos - p_pos % page_size;
+	const uint64_t to = MIN(p_pos + p_bytes, length);
+
+	madvise((void *)(mapping + from), to - from, MADV_WILLNEED);
+#endif
+}
+
 uint64_t LocalStream::get_length() {
-	return file->get_len();
+	return length;
 }
 
 LocalStream::LocalStream(const String p_path) :
 		path(p_path) {
+	if (_map()) {
+		return;
+	}
+
 	file = FileAccess::open(path, FileAccess::READ);
+	ERR_FAIL_COND_MSG(file == nullptr, "Failed to open file: '" + path + "'.");
+
+	length = file->get_len();
+	buffer = memnew_arr(uint8_t, READ_AHEAD_SIZE);
 }
 
 LocalStream::~LocalStream() {
-	file->close();
-	memdelete(file);
+	_unmap();
+
+	if (file != nullptr) {
+		file->close();
+		memdelete(file);
+	}
+	if (buffer != nullptr) {
+		memdelete_arr(buffer);
+	}
 }
@@ -3,13 +3,34 @@
 #include "core/os/file_access.h"
 #include "ebml/stream.hpp"
 
+/**
+ * Stream of a file on disk.
+ *
+ * Where supported, the file is memory mapped so that reads and windows are plain pointer arithmetic. Otherwise it is
+ * read through `FileAccess` with a small read ahead buffer.
+ */
 class LocalStream : public ebml::Stream {
 	const String path;
 
-	FileAccess *file;
+	uint64_t length = 0;
+
+	// Memory mapping of the whole file, or `nullptr` if the file could not be mapped.
+	const uint8_t *mapping = nullptr;
+
+	FileAccess *file = nullptr;
+
+	// Read ahead buffer, so that small reads do not each go through the file.
+	uint8_t *buffer = nullptr;
+	uint64_t buffer_pos = 0;
+	uint64_t buffer_size = 0;
+
+	bool _map();
+	void _unmap();
 
 public:
 	virtual void read(uint8_t *const p_buffer, uint64_t &p_pos, const uint64_t p_bytes);
+	virtual const uint8_t *window(const uint64_t p_pos, const uint64_t p_bytes);
+	virtual void prefetch(const uint64_t p_pos, const uint64_t p_bytes);
 	virtual uint64_t get_length();
 
 	LocalStream(const String p_path);
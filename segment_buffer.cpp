@@ -0,0 +1,105 @@
+#include "segment_buffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+uint64_t SegmentBuffer::get_size() const {
+	return size;
+}
+
+void SegmentBuffer::append(const uint8_t *const p_data, const uint64_t p_bytes) {
+	for (uint64_t done = 0; done < p_bytes;) {
+		uint64_t available;
+		uint8_t *const dst = begin_write(available);
+
+		const uint64_t copy = std::min(available, p_bytes - done);
+		memcpy(dst, p_data + done, copy);
+		commit_write(copy);
+
+		done += copy;
+	}
+}
+
+uint8_t *SegmentBuffer::begin_write(uint64_t &r_bytes) {
+	const uint64_t end = head + size;
+	if (end == segments.size() * SEGMENT_SIZE) {
+		segments.push_back(new uint8_t[SEGMENT_SIZE]);
+	}
+
+	const uint64_t offset = end % SEGMENT_SIZE;
+	r_bytes = SEGMENT_SIZE - offset;
+	return segments[end / SEGMENT_SIZE] + offset;
+}
+
+void SegmentBuffer::commit_write(const uint64_t p_bytes) {
+	size += p_bytes;
+}
+
+void SegmentBuffer::trim_front(const uint64_t p_bytes) {
+	const uint64_t trim = std::min(p_bytes, size);
+	head += trim;
+	size -= trim;
+
+	while (head >= SEGMENT_SIZE) {
+		delete[] segments.front();
+		segments.pop_front();
+		head -= SEGMENT_SIZE;
+	}
+}
+
+void SegmentBuffer::copy(const uint64_t p_offset, uint8_t *const r_buffer, const uint64_t p_bytes) const {
+	for (uint64_t done = 0; done < p_bytes;) {
+		const uint64_t pos = head + p_offset + done;
+		const uint64_t offset = pos % SEGMENT_SIZE;
+
+		const uint64_t copy = std::min(SEGMENT_SIZE - offset, p_bytes - done);
+		memcpy(r_buffer + done, segments[pos / SEGMENT_SIZE] + offset, copy);
+
+		done += copy;
+	}
+}
+
+const uint8_t *SegmentBuffer::span(const uint64_t p_offset, const uint64_t p_bytes) const {
+	const uint64_t pos = head + p_offset;
+	const uint64_t offset = pos % SEGMENT_SIZE;
+	if (p_offset + p_bytes > size || offset + p_bytes > SEGMENT_SIZE) {
+		return nullptr;
+	}
+
+	return segments[pos / SEGMENT_SIZE] + offset;
+}
+
+void SegmentBuffer::clear() {
+	for (uint8_t *const segment : segments) {
+		delete[] segment;
+	}
+	segments.clear();
+	head = 0;
+	size = 0;
+}
+
+SegmentBuffer &SegmentBuffer::operator=(SegmentBuffer &&p_other) {
+	if (this != &p_other) {
+		clear();
+		segments.swap(p_other.segments);
+		head = p_other.head;
+		size = p_other.size;
+		p_other.head = 0;
+		p_other.size = 0;
+	}
+	return *this;
+}
+
+SegmentBuffer::SegmentBuffer(SegmentBuffer &&p_other) :
+		segments(std::move(p_other.segments)), head(p_other.head), size(p_other.size) {
+	p_other.segments.clear();
+	p_other.head = 0;
+	p_other.size = 0;
+}
+
+SegmentBuffer::SegmentBuffer() {
+}
+
+SegmentBuffer::~SegmentBuffer() {
+	clear();
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+/**
+ * Growable byte buffer made of fixed size segments.
+ *
+ * Appending never moves bytes that are already stored, and trimming the front releases whole segments, so neither
+ * copies the rest of the buffer.
+ */
+class SegmentBuffer {
+public:
+	static const uint64_t SEGMENT_SIZE = 65536;
+
+private:
+	std::deque<uint8_t *> segments;
+
+	// Offset of the first byte inside the first segment.
+	uint64_t head = 0;
+	uint64_t size = 0;
+
+public:
+	/**
+	 * @returns The number of bytes stored.
+	 */
+	uint64_t get_size() const;
+
+	/**
+	 * Copy bytes to the end of the buffer.
+	 *
+	 * @param[in] p_data Pointer of the array to copy from.
+	 * @param[in] p_bytes Number of bytes to append.
+	 */
+	void append(const uint8_t *const p_data, const uint64_t p_bytes);
+
+	/**
+	 * Get writable space at the end of the buffer, so that data can be received into it directly.
+	 *
+	 * The bytes only become part of the buffer once they are committed with `commit_write`.
+	 *
+	 * @param[out] r_bytes Number of contiguous bytes that can be written.
+	 * @returns Pointer to the writable space.
+	 */
+	uint8_t *begin_write(uint64_t &r_bytes);
+
+	/**
+	 * Commit bytes written into the space returned by `begin_write`.
+	 *
+	 * @param[in] p_bytes Number of bytes written.
+	 */
+	void commit_write(const uint64_t p_bytes);
+
+	/**
+	 * Remove bytes from the front of the buffer.
+	 *
+	 * @param[in] p_bytes Number of bytes to remove.
+	 */
+	void trim_front(const uint64_t p_bytes);
+
+	/**
+	 * Copy bytes out of the buffer.
+	 *
+	 * @param[in] p_offset Offset of the first byte.
+	 * @param[out] r_buffer Pointer of the array to copy into.
+	 * @param[in] p_bytes Number of bytes to copy.
+	 */
+	void copy(const uint64_t p_offset, uint8_t *const r_buffer, const uint64_t p_bytes) const;
+
+	/**
+	 * Access bytes of the buffer without copying them.
+	 *
+	 * The pointer stays valid until those bytes are trimmed or the buffer is destroyed.
+	 *
+	 * @param[in] p_offset Offset of the first byte.
+	 * @param[in] p_bytes Number of bytes needed.
+	 * @returns A pointer to the bytes, or `nullptr` if they are split across two segments.
+	 */
+	const uint8_t *span(const uint64_t p_offset, const uint64_t p_bytes) const;
+
+	void clear();
+
+	SegmentBuffer &operator=(SegmentBuffer &&p_other);
+	SegmentBuffer(SegmentBuffer &&p_other);
+	SegmentBuffer(const SegmentBuffer &) = delete;
+	SegmentBuffer &operator=(const SegmentBuffer &) = delete;
+
+	SegmentBuffer();
+	~SegmentBuffer();
+};
@@ -2,21 +2,21 @@
 
 #include "ebml/buffer_stream.hpp"
 
-webm::CuePoint::CuePoint(
-		const uint64_t p_pos,
-		const double p_time,
-		const double p_duration) :
-		pos(p_pos), time(p_time), duration(p_duration) {
-}
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
-webm::CuePoint::~CuePoint() {
-}
+// Decoded audio is always stored as stereo, opus up or down mixes the track's channels for us.
+static const uint64_t PCM_CHANNELS = 2;
 
-void webm::Decoder::DecoderContext::delete_cluster(const std::vector<const ebml::Element *> &p_cluster) {
-	for (const ebml::Element *const block : p_cluster) {
-		delete block;
-	}
-}
+// Amount of decoded audio to keep ahead of playback, in seconds.
+static const double PCM_BUFFER_TIME = 0.5;
+
+// Audio decoded before the seek time and dropped, so that opus has converged by the time playback starts.
+static const double SEEK_PREROLL = 0.08;
+
+// Cursor of a cluster loaded for a seek, until the packet to start at has arrived.
+static const uint64_t UNPOSITIONED = UINT64_MAX;
 
 void webm::Decoder::DecoderContext::trim_clusters() {
 	// Assumes the frame buffer is locked.
@@ -26,9 +26,6 @@ void webm::Decoder::DecoderContext::trim_clusters() {
 	// Check if there are too many frame buffers before us.
 	const int64_t extra = active_cluster - MAX_PRIOR_FRAME_BUFFERS;
 	if (extra > 0) {
-		for (uint64_t i = 0; i < (uint64_t)extra; ++i) {
-			delete_cluster(clusters[i]);
-		}
 		clusters.erase(clusters.begin(), clusters.begin() + extra);
 
 		current_cluster += extra;
@@ -48,9 +45,6 @@ webm::Decoder::DecoderContext::~DecoderContext() {
 	if (opus_pcm != nullptr) {
 		delete[] opus_pcm;
 	}
-	for (const std::vector<const ebml::Element *> &cluster : clusters) {
-		delete_cluster(cluster);
-	}
 }
 
 void webm::Decoder::debug_print_element(const ebml::Element *const p_element) {
@@ -79,7 +73,7 @@ double webm::Decoder::get_time(const uint64_t p_time_scale, const double p_raw_t
 	return p_raw_time * p_time_scale / 1000000000.0;
 }
 
-// Load track info and cues from stream.
+// Load track info from stream, and find the first cluster.
 void webm::Decoder::load_headers() {
 	// INFO ELEMENTS (TIMECODE SCALE, DURATION)
 	auto parse_segment_info = [&](
@@ -150,40 +144,6 @@ void webm::Decoder::load_headers() {
 #endif
 	};
 
-	struct RawCuePoint {
-		uint64_t raw_time;
-		uint64_t pos;
-
-		RawCuePoint(const uint64_t p_raw_time, const uint64_t p_pos) :
-				raw_time(p_raw_time), pos(p_pos) {}
-	};
-
-	// CUES ELEMENTS (CUE TIME, CUE TRACK POSITIONS)
-	auto parse_segment_cues = [&](
-									  const ebml::ElementMaster *const p_segment,
-									  const ebml::ElementMaster *const p_cues,
-									  std::vector<RawCuePoint> &r_items) {
-		for (const ebml::Element *const cue : stream->range(p_cues)) {
-			if (cue->reg.id != ELEMENT_CUE_POINT) {
-#ifdef __EXCEPTIONS
-				throw std::runtime_error("Cues element is not a CuePoint.");
-#else
-				continue;
-#endif
-			}
-			const auto c = (const ebml::ElementMaster *)cue;
-
-			auto search = stream->range(c).search();
-			const auto cue_time = search.get<ELEMENT_CUE_TIME, ebml::ElementUint>();
-			const auto track_positions = search.get<ELEMENT_CUE_TRACK_POSITIONS, ebml::ElementMaster>();
-
-			auto search_track_positions = stream->range(track_positions).search();
-			const auto cluster_position = search_track_positions.get<ELEMENT_CUE_CLUSTER_POSITION, ebml::ElementUint>();
-
-			r_items.emplace_back(cue_time->value, p_segment->from + cluster_position->value);
-		}
-	};
-
 	struct SeekItem {
 		ebml::ElementID id;
 		uint64_t pos;
@@ -218,7 +178,7 @@ void webm::Decoder::load_headers() {
 		}
 	};
 
-	// SEGMENT ELEMENTS (SEEK HEAD, INFO, TRACKS, CUES)
+	// SEGMENT ELEMENTS (SEEK HEAD, INFO, TRACKS)
 	auto parse_segment = [&](const ebml::ElementMaster *const p_segment) {
 		// First, search for the seek head element. It should be the first element but for simplicity we will just
 		// iterate until we find it.
@@ -229,7 +189,19 @@ void webm::Decoder::load_headers() {
 		std::vector<SeekItem> seek_items;
 		parse_seek_head(seek_head, seek_items);
 
-		bool parsed_info = false, parsed_tracks = false, parsed_cues = false;
+		// Load what the seek head points at in one round of concurrent requests, instead of one round trip per element.
+		// The sizes are not known yet, but headers are small and anything past this is read as usual.
+		static const uint64_t HEADER_BYTES = 4096;
+
+		std::vector<std::pair<uint64_t, uint64_t>> header_ranges;
+		for (const SeekItem &seek_item : seek_items) {
+			if (seek_item.id != ELEMENT_CUES) {
+				header_ranges.push_back(std::make_pair(seek_item.pos, seek_item.pos + HEADER_BYTES));
+			}
+		}
+		stream->load_ranges(header_ranges);
+
+		bool parsed_info = false, parsed_tracks = false;
 
 		// Info
 		uint64_t time_scale = 0;
@@ -240,10 +212,14 @@ void webm::Decoder::load_headers() {
 		double sampling_rate = 0.0;
 		uint64_t channels = 0;
 
-		// Cues
-		std::vector<RawCuePoint> raw_cues;
-
 		for (const SeekItem &seek_item : seek_items) {
+			// The cues are often far away at the end of the file, and only needed to seek, so they are loaded later.
+			if (seek_item.id == ELEMENT_CUES) {
+				cues_pos = seek_item.pos;
+				segment_pos = p_segment->from;
+				continue;
+			}
+
 			uint64_t pos = seek_item.pos;
 			const ebml::Element *child;
 			stream->read_element(pos, child);
@@ -259,16 +235,11 @@ void webm::Decoder::load_headers() {
 					parse_segment_tracks(c, number, sampling_rate, channels);
 					parsed_tracks = true;
 				} break;
-				case ELEMENT_CUES: {
-					const ebml::ElementMaster *const c = (const ebml::ElementMaster *)child;
-					parse_segment_cues(p_segment, c, raw_cues);
-					parsed_cues = true;
-				} break;
 			}
 
 			delete child;
 
-			if (parsed_info && parsed_tracks && parsed_cues) {
+			if (parsed_info && parsed_tracks && cues_pos != 0) {
 				break;
 			}
 		}
@@ -287,40 +258,26 @@ void webm::Decoder::load_headers() {
 			return;
 #endif
 		}
-		if (!parsed_cues) {
-#ifdef __EXCEPTIONS
-			throw std::runtime_error("Segment seek head does not have a cues element.");
-#else
-			return;
-#endif
-		}
+		const double &duration = get_time(time_scale, raw_duration);
+		context.time_scale = time_scale;
+
+		// Playback starts from the first cluster, which usually comes right after the tracks. Until the cues are
+		// loaded, seeks go through the clusters found while playing and probes for closer ones.
+		auto cluster_search = stream->range(p_segment).search();
+		const auto cluster = cluster_search.get<ELEMENT_CLUSTER, ebml::ElementMaster>();
 
-		if (raw_cues.empty()) {
+		double time;
+		if (cluster == nullptr || !read_cluster_time(cluster->pos, time)) {
 #ifdef __EXCEPTIONS
-			throw std::runtime_error("Segment seek head does not have any cues.");
+			throw std::runtime_error("Segment does not have any clusters.");
 #else
 			return;
 #endif
 		}
-
-		const double &duration = get_time(time_scale, raw_duration);
-
-		for (uint64_t i = 0; i < raw_cues.size(); ++i) {
-			const RawCuePoint &cue = raw_cues[i];
-			const double &start = get_time(time_scale, cue.raw_time);
-
-			double end;
-			if (i + 1 < raw_cues.size()) {
-				end = get_time(time_scale, raw_cues[i + 1].raw_time);
-			} else {
-				end = duration;
-			}
-
-			context.cues.push_back(CuePoint(cue.pos, start, end - start));
-		}
+		context.seek_index.insert(cluster->pos, time);
 
 		int opus_create_result;
-		OpusDecoder *const opus = opus_decoder_create(sampling_rate, channels, &opus_create_result);
+		OpusDecoder *const opus = opus_decoder_create(sampling_rate, PCM_CHANNELS, &opus_create_result);
 		if (opus_create_result != OPUS_OK) {
 #ifdef __EXCEPTIONS
 			throw std::runtime_error("Failed to create opus decoder.");
@@ -329,15 +286,17 @@ void webm::Decoder::load_headers() {
 #endif
 		}
 
-		context.time_scale = time_scale;
 		context.duration = duration;
 		context.track = number;
 		context.sampling_rate = sampling_rate;
 		context.channels = channels;
+		context.byte_rate = duration > 0.0 ? (stream->get_length() - context.seek_index.get_pos(0)) / duration : 0.0;
 
 		context.opus = opus;
 		context.opus_frame_samples = sampling_rate * 0.06 + 0.5;
-		context.opus_pcm = new float[context.opus_frame_samples * channels];
+		context.opus_pcm = new float[context.opus_frame_samples * PCM_CHANNELS];
+
+		pcm.buffer.resize(uint64_t(sampling_rate * PCM_BUFFER_TIME) * PCM_CHANNELS);
 
 		context.ready = true;
 	};
@@ -352,6 +311,210 @@ void webm::Decoder::load_headers() {
 	parse_file();
 }
 
+void webm::Decoder::load_cues() {
+	struct RawCuePoint {
+		uint64_t raw_time;
+		uint64_t pos;
+		uint64_t relative_pos;
+		uint64_t block_number;
+
+		RawCuePoint(const uint64_t p_raw_time, const uint64_t p_pos, const uint64_t p_relative_pos, const uint64_t p_block_number) :
+				raw_time(p_raw_time), pos(p_pos), relative_pos(p_relative_pos), block_number(p_block_number) {}
+	};
+
+	// CUES ELEMENTS (CUE TIME, CUE TRACK POSITIONS)
+	auto parse_cues = [&](const ebml::ElementMaster *const p_cues, std::vector<RawCuePoint> &r_items) {
+		for (const ebml::Element *const cue : stream->range(p_cues)) {
+			if (cue->reg.id != ELEMENT_CUE_POINT) {
+#ifdef __EXCEPTIONS
+				throw std::runtime_error("Cues element is not a CuePoint.");
+#else
+				continue;
+#endif
+			}
+			const auto c = (const ebml::ElementMaster *)cue;
+
+			auto search = stream->range(c).search();
+			const auto cue_time = search.get<ELEMENT_CUE_TIME, ebml::ElementUint>();
+			const auto track_positions = search.get<ELEMENT_CUE_TRACK_POSITIONS, ebml::ElementMaster>();
+
+			// The block position and number are optional, so look for them without a searcher.
+			uint64_t cluster_position = 0, relative_position = 0, block_number = 0;
+			for (const ebml::Element *const position : stream->range(track_positions)) {
+				switch (position->reg.id) {
+					case ELEMENT_CUE_CLUSTER_POSITION: {
+						cluster_position = ((const ebml::ElementUint *)position)->value;
+					} break;
+					case ELEMENT_CUE_RELATIVE_POSITION: {
+						relative_position = ((const ebml::ElementUint *)position)->value;
+					} break;
+					case ELEMENT_CUE_BLOCK_NUMBER: {
+						block_number = ((const ebml::ElementUint *)position)->value;
+					} break;
+				}
+			}
+
+			r_items.emplace_back(cue_time->value, segment_pos + cluster_position, relative_position, block_number);
+		}
+	};
+
+	std::vector<RawCuePoint> raw_cues;
+
+#ifdef __EXCEPTIONS
+	try {
+#endif
+		uint64_t pos = cues_pos;
+		const ebml::Element *element;
+		stream->read_element(pos, element);
+
+		if (element->reg.id == ELEMENT_CUES) {
+			parse_cues((const ebml::ElementMaster *)element, raw_cues);
+		}
+
+		delete element;
+#ifdef __EXCEPTIONS
+	} catch (const std::exception &e) {
+		// Seeking still works without the cues, only slower.
+		std::cerr << "Cues read failed with an exception: '" << e.what() << "'." << std::endl;
+	}
+#endif
+
+	cues_pos = 0;
+
+	std::lock_guard<std::mutex> lock(context.mutex);
+
+	context.seek_index.reserve(context.seek_index.size() + raw_cues.size());
+	for (const RawCuePoint &cue : raw_cues) {
+		index_cluster(cue.pos, get_time(context.time_scale, cue.raw_time), cue.relative_pos, cue.block_number);
+	}
+}
+
+void webm::Decoder::wake_threads() {
+	{
+		std::lock_guard<std::mutex> lock(seeking.mutex);
+	}
+	seeking.condition.notify_all();
+
+	{
+		std::lock_guard<std::mutex> lock(context.mutex);
+	}
+	context.condition.notify_all();
+}
+
+double webm::Decoder::get_prefetch_time(const uint64_t p_index) {
+	// Plan for a throughput this many deviations below the mean, which is rarely any slower.
+	static const double DEVIATIONS = 2.0;
+	// Start loading this many times earlier than the download should take.
+	static const double SAFETY = 2.0;
+
+	if (prefetch_policy.mode == PrefetchPolicy::PREFETCH_FIXED) {
+		return prefetch_policy.time;
+	}
+
+	double rate, deviation, latency;
+	if (!stream->get_bandwidth(rate, deviation, latency)) {
+		// Nothing was measured yet, or the stream is not downloaded.
+		return prefetch_policy.time;
+	}
+
+	const double memory_time = context.byte_rate > 0.0 ? prefetch_policy.memory_cap / context.byte_rate : INFINITY;
+	const double slow_rate = std::max(rate - DEVIATIONS * deviation, rate * 0.1);
+
+	double time;
+	if (slow_rate <= context.byte_rate) {
+		// Playback may consume the stream faster than it arrives, so buffer as much as allowed.
+		time = memory_time;
+	} else {
+		const SeekIndex &index = context.seek_index;
+		const double bytes = p_index + 1 < index.size() ? index.get_pos(p_index + 1) - index.get_pos(p_index) : (context.duration - index.get_time(p_index)) * context.byte_rate;
+		time = SAFETY * (latency + bytes / slow_rate);
+		time = std::min(time, memory_time);
+	}
+
+	return std::max(time, prefetch_policy.min_time);
+}
+
+bool webm::Decoder::read_cluster_time(const uint64_t p_pos, double &r_time) {
+#ifdef __EXCEPTIONS
+	try {
+#endif
+		uint64_t pos = p_pos;
+		ebml::ElementID id;
+		stream->read_id(pos, id);
+		if (id != ELEMENT_CLUSTER) {
+			return false;
+		}
+
+		ebml::ElementSize size;
+		stream->read_size(pos, size);
+
+		// Muxers write the timecode first, and checking for it rules out bytes that only look like a cluster.
+		uint64_t timecode_pos = pos;
+		stream->read_id(pos, id);
+		if (id != ELEMENT_TIMECODE) {
+			return false;
+		}
+
+		const ebml::Element *timecode;
+		stream->read_element(timecode_pos, timecode);
+		r_time = get_time(context.time_scale, ((const ebml::ElementUint *)timecode)->value);
+		delete timecode;
+#ifdef __EXCEPTIONS
+	} catch (const std::exception &) {
+		return false;
+	}
+#endif
+	return true;
+}
+
+bool webm::Decoder::find_cluster(const uint64_t p_from, const uint64_t p_to, uint64_t &r_pos, double &r_time) {
+	static const uint64_t CHUNK_SIZE = 4096;
+	static const uint8_t CLUSTER_ID[] = { 0x1F, 0x43, 0xB6, 0x75 };
+
+	const uint64_t to = std::min(p_to, stream->get_length());
+
+	uint8_t chunk[CHUNK_SIZE];
+	for (uint64_t from = p_from; from + sizeof(CLUSTER_ID) <= to;) {
+		const uint64_t bytes = std::min(CHUNK_SIZE, to - from);
+		uint64_t pos = from;
+		stream->read_binary(pos, chunk, bytes);
+
+		const uint8_t *const begin = chunk;
+		const uint8_t *const end = begin + bytes;
+		const uint8_t *found = std::search(begin, end, CLUSTER_ID, CLUSTER_ID + sizeof(CLUSTER_ID));
+		while (found != end) {
+			r_pos = from + (found - begin);
+			if (read_cluster_time(r_pos, r_time)) {
+				return true;
+			}
+			found = std::search(found + 1, end, CLUSTER_ID, CLUSTER_ID + sizeof(CLUSTER_ID));
+		}
+
+		// The next chunk overlaps this one, in case an ID is split between them.
+		from += bytes - (sizeof(CLUSTER_ID) - 1);
+	}
+
+	return false;
+}
+
+uint64_t webm::Decoder::index_cluster(const uint64_t p_pos, const double p_time, const uint64_t p_relative_pos, const uint64_t p_block_number) {
+	// Assumes the context is locked.
+
+	const uint64_t count = context.seek_index.size();
+	const uint64_t index = context.seek_index.insert(p_pos, p_time, p_relative_pos, p_block_number);
+
+	// The loaded clusters are consecutive, and the cluster after each one is indexed when it is loaded, so a new
+	// entry always comes before or after them.
+	if (context.seek_index.size() > count && index <= context.current_cluster) {
+		++context.current_cluster;
+	}
+	return index;
+}
+
+double webm::Decoder::get_packet_time(const uint64_t p_cluster_timecode, const int16_t p_timecode) const {
+	return get_time(context.time_scale, double(int64_t(p_cluster_timecode) + p_timecode));
+}
+
 void webm::Decoder::_thread_func(void *p_self) {
 	Decoder *const self = (Decoder *)p_self;
 #ifdef __EXCEPTIONS
@@ -362,6 +525,7 @@ void webm::Decoder::_thread_func(void *p_self) {
 	} catch (const std::exception &e) {
 		std::cerr << "Decoder failed with an exception: '" << e.what() << "'." << std::endl;
 		self->terminate_thread = true;
+		self->wake_threads();
 	}
 #endif
 }
@@ -376,128 +540,516 @@ void webm::Decoder::thread_func() {
 	}
 
 	load_headers();
+	wake_threads();
 
-	auto get_cue_before_time = [&](const double &p_time) -> uint64_t {
-		// TODO: Binary search will be faster instead.
-		for (uint64_t i = 1; i < context.cues.size(); ++i) {
-			const CuePoint &cluster = context.cues[i];
-			if (cluster.time > p_time) {
-				return i - 1;
-			}
-		}
-		return context.cues.size() - 1;
+	SeekIndex &seek_index = context.seek_index;
+
+	// Seek generation that the current load is for. A load is abandoned as soon as a newer seek comes in, so that
+	// scrubbing only downloads the position it ends up at.
+	uint64_t load_generation = 0;
+	bool load_cancelled = false;
+
+	auto is_stale = [&]() -> bool {
+		return seeking.generation != load_generation;
+	};
+
+	// Appends a packet, whose payload was already read into the data of the cluster being loaded, which is always the
+	// last one, and wakes the decode thread for it. Assumes the context is locked.
+	auto publish_packet = [&](const uint32_t p_offset, const uint32_t p_size, const int16_t p_timecode) {
+		Packet packet;
+		packet.offset = p_offset;
+		packet.size = p_size;
+		packet.timecode = p_timecode;
+
+		context.clusters.back().packets.push_back(packet);
+		context.condition.notify_all();
 	};
 
-	auto read_cluster = [&](
-								const ebml::ElementMaster *const p_cluster,
-								std::vector<const ebml::Element *> &r_blocks) {
+	// Reads the audio packets in [`p_from`, `p_to`) into the cluster being loaded, skipping anything that is not a block
+	// of our track. Every packet can be decoded as soon as it is read, while the rest of the cluster is still arriving.
+	//
+	// When `p_time` is not negative, the cursor is pointed at the packet that plays it as soon as that packet is read,
+	// which is the only way a cluster being loaded for a seek gets its cursor. The position of every block is recorded
+	// into `r_index` if it is given, and where the read stopped into `r_end`. The read stops early, setting
+	// `load_cancelled`, when a newer seek comes in.
+	auto read_blocks = [&](const uint64_t p_from, const uint64_t p_to, const double p_time, uint64_t &r_end, BlockIndex *const r_index) -> bool {
+		bool positioned = p_time < 0.0;
+		bool success = true;
+
+		// Point the cursor at the packet to start at, once it is known, and skip the samples it has before the seek
+		// time. The decode thread takes care of the pre-roll.
+		auto position = [&](const uint64_t p_packet) {
+			const Cluster &cluster = context.clusters.back();
+			const double start = get_packet_time(cluster.timecode, cluster.packets[p_packet].timecode);
+			context.active_packet = p_packet;
+			context.skip_samples = uint64_t(std::max(p_time - start, 0.0) * context.sampling_rate + 0.5);
+			context.condition.notify_all();
+			positioned = true;
+		};
+
 #ifdef __EXCEPTIONS
 		try {
 #endif
-			r_blocks.reserve(r_blocks.size() + 100);
+			uint64_t pos = p_from;
+			while (pos < p_to) {
+				if (is_stale()) {
+					load_cancelled = true;
+					return false;
+				}
+
+				const uint64_t element_pos = pos;
+
+				ebml::ElementID id;
+				stream->read_id(pos, id);
+
+				// A read from the middle of a cluster stops where the next one starts.
+				if (id == ELEMENT_CLUSTER) {
+					pos = element_pos;
+					break;
+				}
 
-			for (uint64_t pos = p_cluster->from; pos < p_cluster->to;) {
-				const ebml::Element *block;
-				stream->read_element(pos, block);
+				ebml::ElementSize size;
+				stream->read_size(pos, size);
+
+				const uint64_t end = pos + size;
+
+				switch (id) {
+					case ELEMENT_TIMECODE: {
+						uint64_t timecode_pos = element_pos;
+						const ebml::Element *timecode;
+						stream->read_element(timecode_pos, timecode);
+
+						const uint64_t value = ((const ebml::ElementUint *)timecode)->value;
+						if (r_index != nullptr) {
+							r_index->timecode = value;
+						}
+
+						delete timecode;
+
+						std::lock_guard<std::mutex> lock(context.mutex);
+						context.clusters.back().timecode = value;
+					} break;
+					case ELEMENT_SIMPLE_BLOCK: {
+						int64_t track;
+						stream->read_int(pos, track);
+
+						// Ignore blocks that are not the audio track.
+						if (uint64_t(track) != context.track) {
+							break;
+						}
+
+						// Timecode (2 bytes) and flags (1 byte).
+						uint8_t header[3];
+						stream->read_binary(pos, header, 3);
+						const int16_t timecode = int16_t(uint16_t(header[0]) << 8 | header[1]);
+
+						// Growing the data may move it, so it only happens with the context locked. Only this thread
+						// grows it, so the payload is read straight into it without the lock.
+						const uint32_t payload_size = end - pos;
+						uint32_t offset;
+						uint8_t *data;
+						{
+							std::lock_guard<std::mutex> lock(context.mutex);
+							std::vector<uint8_t> &cluster_data = context.clusters.back().data;
+							offset = cluster_data.size();
+							cluster_data.resize(offset + payload_size);
+							data = cluster_data.data();
+						}
+						stream->read_binary(pos, data + offset, payload_size);
+
+						if (r_index != nullptr) {
+							r_index->positions.push_back(element_pos);
+							r_index->timecodes.push_back(timecode);
+						}
+
+						std::lock_guard<std::mutex> lock(context.mutex);
+
+						publish_packet(offset, payload_size, timecode);
+
+						// The packet before the first one that starts after the seek time is the one to start at.
+						const uint64_t count = context.clusters.back().packets.size();
+						if (!positioned && get_packet_time(context.clusters.back().timecode, timecode) > p_time) {
+							position(count > 1 ? count - 2 : 0);
+						}
+					} break;
+				}
 
-				r_blocks.push_back(block);
+				pos = end;
 			}
+
+			r_end = pos;
 #ifdef __EXCEPTIONS
 		} catch (const std::exception &e) {
 			std::cerr << "Cluster read failed with an exception: '" << e.what() << "'." << std::endl;
+			success = false;
 		}
 #endif
+
+		std::lock_guard<std::mutex> lock(context.mutex);
+		if (!positioned && !load_cancelled && !context.clusters.back().packets.empty()) {
+			// Every packet starts before the seek time, so play from the last one.
+			position(context.clusters.back().packets.size() - 1);
+		}
+		return success;
+	};
+
+	// Loads the cluster at `p_index` as the last loaded cluster. When `p_time` is not negative, only the blocks needed
+	// to play from it are read, if the block index or the cues tell where they are. The cluster after it is returned
+	// in `r_next_pos` and `r_next_time`, with a zero position if there is none, so that it can be indexed when the cues
+	// skip it.
+	auto read_cluster = [&](const uint64_t p_index, const double p_time, uint64_t &r_next_pos, double &r_next_time) {
+		// Skipping less than this is not worth giving up on indexing the whole cluster.
+		static const uint64_t MIN_SKIP = 4096;
+		// Bytes reserved for a read from the middle of a cluster, which only stops at the next indexed cluster or the
+		// end of the stream. A cluster holds a few seconds of audio, rarely more than this, and grows past it if needed.
+		static const uint64_t PARTIAL_RESERVE = 262144;
+
+		const uint64_t cluster_pos = seek_index.get_pos(p_index);
+		const uint64_t next_pos = p_index + 1 < seek_index.size() ? seek_index.get_pos(p_index + 1) : stream->get_length();
+
+		auto has_packets = [&]() -> bool {
+			std::lock_guard<std::mutex> lock(context.mutex);
+			return !context.clusters.back().packets.empty();
+		};
+
+		// Start over from the whole cluster, unless the decode thread may already be using what was read.
+		auto reset = [&]() -> bool {
+			std::lock_guard<std::mutex> lock(context.mutex);
+			Cluster &cluster = context.clusters.back();
+			if (!cluster.packets.empty()) {
+				return false;
+			}
+			cluster = Cluster();
+			cluster.pos = cluster_pos;
+			cluster.loading = true;
+			return true;
+		};
+
+		bool cached;
+		{
+			std::lock_guard<std::mutex> lock(context.mutex);
+			cached = pcm_cache.has_state(cluster_pos);
+
+			context.clusters.emplace_back();
+			context.clusters.back().pos = cluster_pos;
+			context.clusters.back().loading = true;
+		}
+
+		auto read = [&]() -> bool {
+			// A cluster read from its start can resume from the audio and state cached for it.
+			if (p_time >= 0.0 && !cached) {
+				const std::map<uint64_t, BlockIndex>::const_iterator found = block_indices.find(cluster_pos);
+				const uint64_t relative_pos = seek_index.get_relative_pos(p_index);
+
+				uint64_t from = 0;
+				if (found != block_indices.end()) {
+					// Start at the last block before the pre-roll.
+					const BlockIndex &index = found->second;
+					const std::vector<int16_t>::const_iterator after = std::upper_bound(
+							index.timecodes.begin(), index.timecodes.end(), p_time - SEEK_PREROLL,
+							[&](const double p_value, const int16_t p_timecode) { return p_value < get_packet_time(index.timecode, p_timecode); });
+
+					if (after != index.timecodes.begin() && after != index.timecodes.end()) {
+						const uint64_t block = after - index.timecodes.begin() - 1;
+						if (index.positions[block] - cluster_pos >= MIN_SKIP) {
+							from = index.positions[block];
+
+							std::lock_guard<std::mutex> lock(context.mutex);
+							context.clusters.back().timecode = index.timecode;
+						}
+					}
+				} else if (relative_pos >= MIN_SKIP && seek_index.get_time(p_index) <= p_time) {
+					// The relative position starts after the header of the cluster, which has to be read to know its size.
+					// The timecode comes first in the data, and has to be known before any packet is published.
+					uint64_t data_pos = cluster_pos;
+					ebml::ElementID id;
+					stream->read_id(data_pos, id);
+					ebml::ElementSize size;
+					stream->read_size(data_pos, size);
+
+					uint64_t timecode_pos = data_pos;
+					stream->read_id(timecode_pos, id);
+					if (id == ELEMENT_TIMECODE) {
+						timecode_pos = data_pos;
+						const ebml::Element *timecode;
+						stream->read_element(timecode_pos, timecode);
+						from = data_pos + relative_pos;
+
+						std::lock_guard<std::mutex> lock(context.mutex);
+						context.clusters.back().timecode = ((const ebml::ElementUint *)timecode)->value;
+						delete timecode;
+					}
+				}
+
+				if (from != 0) {
+					{
+						std::lock_guard<std::mutex> lock(context.mutex);
+						context.clusters.back().partial = true;
+						context.clusters.back().data.reserve(std::min(next_pos - from, PARTIAL_RESERVE));
+					}
+					if (read_blocks(from, next_pos, p_time, r_next_pos, nullptr) && has_packets()) {
+						return true;
+					}
+					if (load_cancelled) {
+						return false;
+					}
+					if (!reset()) {
+						return true;
+					}
+				}
+			}
+
+			uint64_t pos = cluster_pos;
+			const ebml::Element *element;
+			stream->read_element(pos, element);
+			const ebml::ElementMaster *const cluster = (const ebml::ElementMaster *)element;
+
+			{
+				// The payloads can never be larger than the cluster itself.
+				std::lock_guard<std::mutex> lock(context.mutex);
+				context.clusters.back().data.reserve(cluster->to - cluster->from);
+			}
+
+			BlockIndex index;
+			const bool success = read_blocks(cluster->from, cluster->to, p_time, r_next_pos, &index);
+			if (success) {
+				block_indices[cluster_pos] = std::move(index);
+			}
+
+			delete element;
+			return success;
+		};
+
+		r_next_pos = 0;
+		load_cancelled = false;
+		const bool success = read();
+
+		{
+			std::lock_guard<std::mutex> lock(context.mutex);
+			if (load_cancelled) {
+				// The decode thread is repositioned for the newer seek next, and a cluster cut short must not stay
+				// loaded for it.
+				context.clusters.pop_back();
+			} else {
+				context.clusters.back().loading = false;
+			}
+			context.condition.notify_all();
+		}
+
+		if (!success || load_cancelled || r_next_pos == 0 || r_next_pos >= stream->get_length() || !read_cluster_time(r_next_pos, r_next_time)) {
+			r_next_pos = 0;
+		}
+	};
+
+	// Finds the packet that plays `p_time`, and how many of its samples to drop. The decode thread takes care of the
+	// pre-roll.
+	auto find_packet = [&](const Cluster &p_cluster, const double p_time, uint64_t &r_packet, uint64_t &r_skip_samples) {
+		const std::vector<Packet>::const_iterator after = std::upper_bound(
+				p_cluster.packets.begin(), p_cluster.packets.end(), p_time,
+				[&](const double p_value, const Packet &p_packet) { return p_value < get_packet_time(p_cluster.timecode, p_packet.timecode); });
+
+		r_packet = after == p_cluster.packets.begin() ? 0 : after - p_cluster.packets.begin() - 1;
+		r_skip_samples = 0;
+		if (r_packet < p_cluster.packets.size()) {
+			const double start = get_packet_time(p_cluster.timecode, p_cluster.packets[r_packet].timecode);
+			r_skip_samples = uint64_t(std::max(p_time - start, 0.0) * context.sampling_rate + 0.5);
+		}
+	};
+
+	// Let the stream know that a cluster is about to be read, so it can start loading it in the background.
+	auto prefetch_cluster = [&](const uint64_t p_index) {
+		if (p_index >= seek_index.size()) {
+			return;
+		}
+
+		const uint64_t from = seek_index.get_pos(p_index);
+		const uint64_t to = p_index + 1 < seek_index.size() ? seek_index.get_pos(p_index + 1) : stream->get_length();
+		stream->prefetch(from, to - from);
+	};
+
+	// Seconds until the next cluster should be loaded, or infinity if every remaining cluster is loaded.
+	auto get_prefetch_delay = [&]() -> double {
+		std::lock_guard<std::mutex> lock(context.mutex);
+
+		const uint64_t load_next = context.current_cluster + context.clusters.size();
+		if (load_next >= seek_index.size()) {
+			return INFINITY;
+		}
+		return seek_index.get_time(load_next) - get_prefetch_time(load_next) - position;
+	};
+
+	// Finds the cluster to play `p_time` from. When the closest indexed cluster is far before it, because the cues are
+	// sparse or missing, the position of a closer one is interpolated from the bitrate and scanned for.
+	auto locate_cluster = [&](const double p_time) -> uint64_t {
+		// Decoding this much audio only to drop it takes longer than probing for a closer cluster.
+		static const double MAX_DECODE_TIME = 20.0;
+		// Aim this far before the seek time, so that the cluster found is likely to start before it.
+		static const double PROBE_MARGIN = 5.0;
+		// Bytes scanned for a cluster after an estimated position.
+		static const uint64_t PROBE_SCAN = 1000000;
+		static const uint64_t MAX_PROBES = 3;
+
+		uint64_t index = seek_index.find(p_time);
+
+		uint64_t lower_pos = seek_index.get_pos(index);
+		double lower_time = seek_index.get_time(index);
+		uint64_t upper_pos = index + 1 < seek_index.size() ? seek_index.get_pos(index + 1) : stream->get_length();
+		double upper_time = index + 1 < seek_index.size() ? seek_index.get_time(index + 1) : context.duration;
+
+		for (uint64_t probe = 0; probe < MAX_PROBES && p_time - lower_time > MAX_DECODE_TIME && upper_time > lower_time && !is_stale(); ++probe) {
+			const double target = std::max(p_time - PROBE_MARGIN, lower_time);
+			const uint64_t estimate = lower_pos + uint64_t((target - lower_time) / (upper_time - lower_time) * (upper_pos - lower_pos));
+
+			uint64_t pos;
+			double time;
+			if (!find_cluster(estimate, std::min(estimate + PROBE_SCAN, upper_pos), pos, time) || pos <= lower_pos) {
+				break;
+			}
+
+			if (time > p_time) {
+				// Overshot, so aim between the clusters on either side again.
+				upper_pos = pos;
+				upper_time = time;
+			} else {
+				lower_pos = pos;
+				lower_time = time;
+			}
+
+			std::lock_guard<std::mutex> lock(context.mutex);
+			index_cluster(pos, time);
+			index = seek_index.find(p_time);
+		}
+
+		return index;
 	};
 
 	while (!terminate_thread) {
 		bool seek_job;
 		double seek_time;
+		uint64_t seek_generation;
 		{
-			std::lock_guard<std::mutex> lock(seeking.mutex);
+			std::unique_lock<std::mutex> lock(seeking.mutex);
+
+			// Sleep until we are asked to seek, a cluster needs to be loaded, or the decoder is destroyed. The decode
+			// thread wakes us up once playback reaches `load_time`, and early when it moves on to the next cluster.
+			// Nothing wakes us up while playback is paused.
+			while (!terminate_thread && !seeking.job) {
+				const double delay = get_prefetch_delay();
+				if (delay <= 0.0) {
+					break;
+				}
+
+				seeking.load_time = position + delay;
+				seeking.condition.wait(lock);
+			}
+			seeking.load_time = INFINITY;
 
 			seek_job = seeking.job;
 			seek_time = seeking.time;
+			seek_generation = seeking.generation;
 
 			seeking.job = false;
 		}
 
+		load_generation = seek_generation;
+
 		if (seek_job) {
-			const uint64_t &cue_index = get_cue_before_time(seek_time);
-			const CuePoint &cue = context.cues[cue_index];
+			// Seeking past the clusters found so far is when the cues are worth waiting for.
+			if (cues_pos != 0 && seek_time > seek_index.get_time(seek_index.size() - 1)) {
+				load_cues();
+			}
 
-			const double percent = (seek_time - cue.time) / cue.duration;
-			if (percent >= 1.0) {
+			const uint64_t index = locate_cluster(seek_time);
+
+			// Points the cursor at the seek time if its cluster is loaded already, under one lock so that the decode
+			// thread cannot trim the clusters in between. A cluster read from the middle may start after the seek time.
+			auto reposition_loaded = [&]() -> bool {
 				std::lock_guard<std::mutex> lock(context.mutex);
 
-				for (const std::vector<const ebml::Element *> &cluster : context.clusters) {
-					context.delete_cluster(cluster);
+				if (index < context.current_cluster || index >= context.current_cluster + context.clusters.size()) {
+					return false;
 				}
-				context.clusters.clear();
 
-				context.current_cluster = context.cues.size();
-				context.active_cluster = 0;
-				context.active_block = 0;
+				const Cluster &cluster = context.clusters[index - context.current_cluster];
+				if (cluster.partial && (cluster.packets.empty() || get_packet_time(cluster.timecode, cluster.packets.front().timecode) > seek_time)) {
+					return false;
+				}
 
-				context.opus_pcm_size = 0;
-			} else if (context.current_cluster <= cue_index && cue_index < context.current_cluster + context.clusters.size()) {
-				// We already have this cluster in the cache.
+				context.active_cluster = index - context.current_cluster;
+				find_packet(cluster, seek_time, context.active_packet, context.skip_samples);
+				context.trim_clusters();
+
+				context.generation = seek_generation;
+				context.condition.notify_all();
+				return true;
+			};
 
+			if (seek_time >= context.duration) {
 				std::lock_guard<std::mutex> lock(context.mutex);
 
-				context.active_cluster = cue_index - context.current_cluster;
-				context.active_block = percent * context.clusters[context.active_cluster].size();
-				context.trim_clusters();
+				context.clusters.clear();
 
-				context.opus_pcm_size = 0;
-			} else {
+				context.current_cluster = seek_index.size();
+				context.active_cluster = 0;
+				context.active_packet = 0;
+				context.skip_samples = 0;
+
+				context.generation = seek_generation;
+				context.condition.notify_all();
+			} else if (!reposition_loaded()) {
 				// We do not have this cluster in the cache, so load it.
 
 				{
 					std::lock_guard<std::mutex> lock(context.mutex);
 
-					for (const std::vector<const ebml::Element *> &cluster : context.clusters) {
-						context.delete_cluster(cluster);
-					}
 					context.clusters.clear();
 
-					context.opus_pcm_size = 0;
-				}
+					// Nothing can be decoded until the packet to start at arrives.
+					context.current_cluster = index;
+					context.active_cluster = 0;
+					context.active_packet = UNPOSITIONED;
+					context.skip_samples = 0;
 
-				const ebml::Element *element;
-				uint64_t pos = cue.pos;
-				stream->read_element(pos, element);
-
-				std::vector<const ebml::Element *> blocks;
-				read_cluster((const ebml::ElementMaster *)element, blocks);
+					context.generation = seek_generation;
+					context.condition.notify_all();
+				}
 
-				std::lock_guard<std::mutex> lock(context.mutex);
+				prefetch_cluster(index);
+				prefetch_cluster(index + 1);
 
-				context.clusters.push_back(blocks);
+				uint64_t next_pos;
+				double next_time;
+				read_cluster(index, seek_time, next_pos, next_time);
 
-				context.current_cluster = cue_index;
-				context.active_cluster = 0;
-				context.active_block = percent * blocks.size();
+				if (next_pos != 0) {
+					std::lock_guard<std::mutex> lock(context.mutex);
+					index_cluster(next_pos, next_time);
+				}
 			}
 		}
 
-		const uint64_t &load_next = context.current_cluster + context.clusters.size();
-		if (load_next < context.cues.size()) {
-			const CuePoint &cue = context.cues[load_next];
-			if (cue.time < position + 10.0) {
-				uint64_t pos = cue.pos;
-				const ebml::Element *element;
-				stream->read_element(pos, element);
+		if (get_prefetch_delay() <= 0.0) {
+			uint64_t load_next;
+			{
+				std::lock_guard<std::mutex> lock(context.mutex);
+				load_next = context.current_cluster + context.clusters.size();
+			}
 
-				std::vector<const ebml::Element *> blocks;
-				read_cluster((const ebml::ElementMaster *)element, blocks);
+			// By the time this cluster is read, the one after it should be coming in.
+			prefetch_cluster(load_next + 1);
 
-				std::lock_guard<std::mutex> lock(context.mutex);
+			uint64_t next_pos;
+			double next_time;
+			read_cluster(load_next, -1.0, next_pos, next_time);
 
-				context.clusters.push_back(blocks);
+			if (next_pos != 0) {
+				std::lock_guard<std::mutex> lock(context.mutex);
+				index_cluster(next_pos, next_time);
 			}
+		} else if (cues_pos != 0) {
+			// Playback is far enough ahead to spare the request.
+			load_cues();
 		}
-
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
 	}
 }
 
@@ -527,163 +1079,362 @@ void webm::Decoder::seek(const double p_time) {
 	position = p_time;
 	seeking.time = p_time;
 	seeking.job = true;
+	++seeking.generation;
+
+	seeking.condition.notify_one();
 }
 
-void webm::Decoder::sample(
-		audio::AudioFrame *const p_buffer,
-		const uint64_t p_frames,
-		bool &r_active,
-		bool &r_buffering) {
-	// If an error occured at some point, play silence.
-	if (terminate_thread) {
-		for (uint64_t i = 0; i < p_frames; ++i) {
-			p_buffer[i] = audio::AudioFrame();
-		}
-		r_active = true;
-		r_buffering = false;
-		return;
+bool webm::Decoder::decode_opus(const Cluster &p_cluster, const uint64_t p_packet, uint64_t &r_samples) {
+	// Assumes the context is locked.
+
+	const Packet &packet = p_cluster.packets[p_packet];
+	const int samples = opus_decode_float(
+			context.opus,
+			p_cluster.data.data() + packet.offset,
+			packet.size,
+			context.opus_pcm,
+			context.opus_frame_samples,
+			0);
+
+	if (samples < 0) {
+#ifdef __EXCEPTIONS
+		throw std::runtime_error("Failed to decode opus block.");
+#else
+		std::cerr << "Failed to decode opus block." << std::endl;
+		return false;
+#endif
 	}
 
-	// If context is not ready, keep active while we're waiting.
-	if (!context.ready) {
-		for (uint64_t i = 0; i < p_frames; ++i) {
-			p_buffer[i] = audio::AudioFrame();
+	r_samples = samples;
+	return true;
+}
+
+bool webm::Decoder::is_synced(const Cluster &p_cluster, const uint64_t p_packet) const {
+	// Assumes the context is locked.
+
+	if (!codec.valid) {
+		return false;
+	}
+	if (codec.cluster == p_cluster.pos) {
+		return codec.packet == p_packet;
+	}
+
+	// The end of a cluster is the start of the one loaded after it.
+	if (p_packet != 0 || context.active_cluster == 0) {
+		return false;
+	}
+	const Cluster &previous = context.clusters[context.active_cluster - 1];
+	return codec.cluster == previous.pos && codec.packet == previous.packets.size();
+}
+
+void webm::Decoder::sync_codec(const Cluster &p_cluster, const uint64_t p_packet) {
+	// Assumes the context is locked.
+
+	uint64_t from = 0;
+	if (!p_cluster.partial && pcm_cache.restore_state(p_cluster.pos, context.opus)) {
+		codec.unsettled_samples = 0;
+	} else {
+		opus_decoder_ctl(context.opus, OPUS_RESET_STATE);
+
+		// Opus needs a while to converge, so start with the loaded packets that make up the pre-roll.
+		const double start = get_packet_time(p_cluster.timecode, p_cluster.packets[p_packet].timecode);
+		from = p_packet;
+		while (from > 0 && get_packet_time(p_cluster.timecode, p_cluster.packets[from].timecode) > start - SEEK_PREROLL) {
+			--from;
 		}
-		r_active = true;
-		if(++context.sample_attempts > 10) {
-			r_buffering = true;
+
+		// Nothing comes before the start of the stream, so it needs no pre-roll.
+		const double preroll = start - get_packet_time(p_cluster.timecode, p_cluster.packets[from].timecode);
+		const bool stream_start = !p_cluster.partial && p_packet == 0 && p_cluster.pos == context.seek_index.get_pos(0);
+		codec.unsettled_samples = stream_start ? 0 : uint64_t(std::max(SEEK_PREROLL - preroll, 0.0) * context.sampling_rate);
+	}
+
+	for (uint64_t i = from; i < p_packet; ++i) {
+		uint64_t samples;
+		if (!decode_opus(p_cluster, i, samples)) {
+			break;
 		}
-		return;
 	}
 
-	const std::lock_guard<std::mutex> slock(seeking.mutex);
-	const std::lock_guard<std::mutex> clock(context.mutex);
+	codec.valid = true;
+	codec.cluster = p_cluster.pos;
+	codec.packet = p_packet;
+}
+
+webm::Decoder::DecodeResult webm::Decoder::decode_packet() {
+	// Assumes the context is locked.
 
-	const auto parse_block = [&](const ebml::Element *const p_block) -> bool {
-		switch (p_block->reg.id) {
-			case ELEMENT_TIMECODE: {
-				context.opus_pcm_index = 0;
-				context.opus_pcm_size = 0;
+	while (context.active_cluster < context.clusters.size()) {
+		const Cluster &cluster = context.clusters[context.active_cluster];
+		if (context.active_packet >= cluster.packets.size()) {
+			if (cluster.loading) {
+				// The rest of the cluster is still arriving.
+				return DECODE_WAITING;
 			}
-				return true;
-			case ELEMENT_SIMPLE_BLOCK: {
-				const ebml::ElementBinary *const block = (const ebml::ElementBinary *)p_block;
 
-				ebml::BufferStream block_stream(block->data, block->size);
+			// Go to next cluster.
+			++context.active_cluster;
+			context.active_packet = 0;
 
-				uint64_t pos = 0;
+			context.trim_clusters();
+			continue;
+		}
 
-				int64_t track;
-				block_stream.read_int(pos, track);
+		const uint64_t index = context.active_packet;
+		++context.active_packet;
 
-				// Ignore blocks that are not the audio track.
-				if (uint64_t(track) != context.track) {
-					return false;
-				}
+		// Audio decoded before plays from memory, until it runs out and the opus state has to catch up.
+		uint64_t samples;
+		bool cached = false;
+		if (!is_synced(cluster, index)) {
+			cached = !cluster.partial && pcm_cache.read_packet(cluster.pos, index, context.opus_pcm, samples);
+			if (!cached) {
+				sync_codec(cluster, index);
+			}
+		}
 
-				pos += 2; // Consume timecode.
-				pos += 1; // Consume flags.
+		if (!cached) {
+			// Only audio that sounds like a decode from the start of the stream is worth keeping.
+			const bool settled = codec.unsettled_samples == 0 && !cluster.partial;
+			if (settled && index == 0) {
+				pcm_cache.store_state(cluster.pos, context.opus);
+			}
 
-				const int samples = opus_decode_float(
-						context.opus,
-						block->data + pos,
-						block->size - pos,
-						context.opus_pcm,
-						context.opus_frame_samples,
-						0);
+			if (!decode_opus(cluster, index, samples)) {
+				return DECODE_FINISHED;
+			}
 
-				if (samples < 0) {
+			codec.cluster = cluster.pos;
+			codec.packet = index + 1;
+			codec.unsettled_samples -= std::min(codec.unsettled_samples, samples);
+
+			if (settled) {
+				pcm_cache.store_packet(cluster.pos, index, context.opus_pcm, samples);
+			}
+		}
+
+		// Drop what comes before the seek time.
+		const uint64_t skip = std::min(context.skip_samples, samples);
+		context.skip_samples -= skip;
+
+		pcm.buffer.write(context.opus_pcm + skip * PCM_CHANNELS, (samples - skip) * PCM_CHANNELS);
+		return DECODE_OK;
+	}
+
+	if (context.current_cluster + context.active_cluster >= context.seek_index.size()) {
+		return DECODE_FINISHED;
+	}
+
+	return DECODE_WAITING;
+}
+
+void webm::Decoder::_decode_thread_func(void *p_self) {
+	Decoder *const self = (Decoder *)p_self;
 #ifdef __EXCEPTIONS
-					throw std::runtime_error("Failed to decode opus block.");
-#else
-					std::cerr << "Failed to decode opus block." << std::endl;
-					return false;
+	try {
 #endif
-				}
+		self->decode_thread_func();
+#ifdef __EXCEPTIONS
+	} catch (const std::exception &e) {
+		std::cerr << "Decoder failed with an exception: '" << e.what() << "'." << std::endl;
+		self->terminate_thread = true;
+		self->wake_threads();
+	}
+#endif
+}
 
-				context.opus_pcm_index = 0;
-				context.opus_pcm_size = samples;
-			}
-				return true;
-			case ELEMENT_BLOCK_GROUP: {
-				// No behaviour for BlockGroup.
-			}
-				return true;
-			default: {
-				std::cerr << "Invalid audio block: " << p_block->reg.name << "." << std::endl;
+void webm::Decoder::decode_thread_func() {
+	uint64_t generation = 0;
+
+	// The drain is checked once per wake up, as nothing that shrinks the loaded audio happens in between.
+	bool check_drain = true;
+
+	std::unique_lock<std::mutex> lock(context.mutex);
+
+	while (!terminate_thread) {
+		if (!context.ready) {
+			context.condition.wait(lock);
+			continue;
+		}
+
+		if (generation != context.generation) {
+			// The cluster cursor moved, so everything decoded so far is stale.
+			generation = context.generation;
+
+			// Clusters read for the seek may be numbered differently, so the opus state has to be brought to the new
+			// cursor before decoding.
+			codec.valid = false;
+
+			pcm.finished = false;
+			pcm.flush_pos = pcm.buffer.get_write_pos();
+			pcm.generation = generation;
+		}
+
+		const uint64_t packet_size = context.opus_frame_samples * PCM_CHANNELS;
+		const uint64_t cluster = context.current_cluster + context.active_cluster;
+
+		DecodeResult result = DECODE_OK;
+		while (!pcm.finished && pcm.buffer.get_available_write() >= packet_size) {
+			result = decode_packet();
+			if (result == DECODE_FINISHED) {
+				pcm.finished = true;
+			} else if (result == DECODE_WAITING) {
+				break;
 			}
-				return false;
 		}
-	};
 
-	for (uint64_t pos = 0; pos < p_frames;) {
-		if(context.current_cluster + context.active_cluster >= context.cues.size()) {
-			r_active = false;
-			r_buffering = false;
-			return;
+		// Wake the load thread up when the loaded audio ahead of playback shrank, or playback reached the time it
+		// wanted to load at. It locks the context while holding its own mutex, so ours is released first.
+		double load_time = seeking.load_time;
+		const bool load_due = position >= load_time && seeking.load_time.compare_exchange_strong(load_time, INFINITY);
+		const bool wake_load = load_due || context.current_cluster + context.active_cluster != cluster;
+
+		// Tell the owner that playback is about to run out of loaded audio, also without the context locked.
+		std::function<void()> drained;
+		if (check_drain && drain.callback && find_loaded_until() - position < drain.time) {
+			drained = drain.callback;
 		}
+		check_drain = false;
 
-		if (seeking.job || context.active_cluster >= context.clusters.size()) {
-			for (; pos < p_frames; ++pos) {
-				p_buffer[pos] = audio::AudioFrame();
+		if (wake_load || drained) {
+			lock.unlock();
+			if (wake_load) {
+				{
+					std::lock_guard<std::mutex> seeking_lock(seeking.mutex);
+				}
+				seeking.condition.notify_one();
 			}
-			r_active = true;
-			if(++context.sample_attempts > 10) {
-				r_buffering = true;
+			if (drained) {
+				drained();
 			}
-			return;
+			lock.lock();
+			continue;
 		}
 
-		if (context.opus_pcm_index >= context.opus_pcm_size) {
-			while (context.active_cluster < context.clusters.size()) {
-				const std::vector<const ebml::Element *> blocks = context.clusters[context.active_cluster];
-				if (context.active_block < blocks.size()) {
-					const ebml::Element *const block = blocks[context.active_block];
-					const bool parse_flag = parse_block(block);
+		if (pcm.finished || result == DECODE_WAITING) {
+			// Nothing to do until the load thread seeks or pushes a cluster.
+			context.condition.wait(lock);
+		} else {
+			// The buffer is full, sleep until `sample` reports that playback has drained half of it.
+			pcm.drained = false;
+			context.condition.wait(lock);
+		}
+		check_drain = true;
+	}
+}
+
+void webm::Decoder::sample(
+		audio::AudioFrame *const p_buffer,
+		const uint64_t p_frames,
+		bool &r_active,
+		bool &r_buffering) {
+	const auto fill_silence = [&](const uint64_t p_from) {
+		memset(p_buffer + p_from, 0, (p_frames - p_from) * sizeof(audio::AudioFrame));
+	};
+
+	// If an error occured at some point, play silence.
+	if (terminate_thread) {
+		fill_silence(0);
+		r_active = true;
+		r_buffering = false;
+		return;
+	}
+
+	// If context is not ready or the last seek has not been decoded yet, keep active while we're waiting.
+	if (!context.ready || pcm.generation != seeking.generation) {
+		fill_silence(0);
+		r_active = true;
+		if (++context.sample_attempts > 10) {
+			r_buffering = true;
+		}
+		return;
+	}
 
-					++context.active_block;
+	pcm.buffer.discard_until(pcm.flush_pos);
 
-					if (!parse_flag) {
-						r_active = false;
-						r_buffering = false;
-						return;
-					}
+	// Frames are laid out like the interleaved stereo samples of the ring buffer, so they are copied straight in.
+	const uint64_t pos = pcm.buffer.read((float *)p_buffer, p_frames * PCM_CHANNELS) / PCM_CHANNELS;
 
-					break;
-				}
-				// Go to next cluster.
-				++context.active_cluster;
-				context.active_block = 0;
+	// A seek may store the position concurrently, so the advance is added to the current value instead of replacing it.
+	const double elapsed = pos / get_sample_rate();
+	double current = position;
+	while (!position.compare_exchange_weak(current, current + elapsed)) {
+	}
 
-				context.trim_clusters();
-			}
+	// Wake the decode thread up once, when playback drains half of the buffer. The audio thread never waits for the
+	// lock, if it is held the wake up is tried again on the next mix. The decode thread clears `drained` and sleeps
+	// without releasing it in between, so the wake up cannot be missed.
+	if (!pcm.drained && pcm.buffer.get_available_read() <= pcm.buffer.get_capacity() / 2) {
+		std::unique_lock<std::mutex> lock(context.mutex, std::try_to_lock);
+		if (lock.owns_lock()) {
+			pcm.drained = true;
+			context.condition.notify_all();
 		}
+	}
 
-		if (context.opus_pcm_index < context.opus_pcm_size) {
-			const uint64_t copy = std::min(context.opus_pcm_size - context.opus_pcm_index, p_frames - pos);
-			const uint64_t pcm_index = context.opus_pcm_index * context.channels;
-			for (uint64_t i = 0; i < copy; ++i) {
-				p_buffer[pos + i] = audio::AudioFrame(
-						context.opus_pcm[pcm_index + i * context.channels],
-						context.opus_pcm[pcm_index + i * context.channels + 1]);
-			}
+	if (pos < p_frames) {
+		fill_silence(pos);
 
-			position += copy / get_sample_rate();
-			pos += copy;
-			context.opus_pcm_index += copy;
+		if (pcm.finished && pcm.buffer.get_available_read() == 0) {
+			r_active = false;
 			r_buffering = false;
+			return;
 		}
+
+		r_active = true;
+		if (++context.sample_attempts > 10) {
+			r_buffering = true;
+		}
+		return;
 	}
 
-	r_active = context.current_cluster + context.active_cluster < context.cues.size();
+	r_active = !pcm.finished || pcm.buffer.get_available_read() > 0;
+	r_buffering = false;
 	context.sample_attempts = 0;
 }
 
-webm::Decoder::Decoder(ebml::Stream *const p_stream) :
-		stream(p_stream), thread(std::thread(_thread_func, this)) {
+double webm::Decoder::get_loaded_until() {
+	if (!context.ready) {
+		return 0.0;
+	}
+
+	std::lock_guard<std::mutex> lock(context.mutex);
+
+	return find_loaded_until();
+}
+
+double webm::Decoder::find_loaded_until() const {
+	// A cluster that is still arriving only counts from its start.
+	const bool loading = !context.clusters.empty() && context.clusters.back().loading;
+	const uint64_t load_next = context.current_cluster + context.clusters.size() - loading;
+	if (load_next >= context.seek_index.size()) {
+		return INFINITY;
+	}
+	return context.seek_index.get_time(load_next);
+}
+
+bool webm::Decoder::has_decoded_audio() const {
+	// Anything written before `flush_pos` is stale and discarded by `sample`.
+	return context.ready && pcm.generation == seeking.generation && pcm.buffer.get_write_pos() > pcm.flush_pos && pcm.buffer.get_available_read() > 0;
+}
+
+void webm::Decoder::set_drain_callback(const double p_time, const std::function<void()> &p_callback) {
+	std::lock_guard<std::mutex> lock(context.mutex);
+
+	drain.time = p_time;
+	drain.callback = p_callback;
+}
+
+webm::Decoder::Decoder(ebml::Stream *const p_stream, const PrefetchPolicy &p_prefetch_policy, const PcmCachePolicy &p_pcm_cache_policy) :
+		stream(p_stream), prefetch_policy(p_prefetch_policy), pcm_cache(p_pcm_cache_policy, PCM_CHANNELS) {
+	thread = std::thread(_thread_func, this);
+	decode_thread = std::thread(_decode_thread_func, this);
 }
 
 webm::Decoder::~Decoder() {
 	terminate_thread = true;
+	wake_threads();
+
 	thread.join();
+	decode_thread.join();
 }
@@ -1,9 +1,16 @@
 #pragma once
 
 #include "audio/decoder.hpp"
+#include "audio/ring_buffer.hpp"
 #include "ebml/stream.hpp"
+#include "pcm_cache.hpp"
+#include "seek_index.hpp"
 
 #include <opus/opus.h>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
 #include <map>
 #include <mutex>
 #include <thread>
@@ -11,41 +18,123 @@
 
 namespace webm {
 /**
- * Cue point found inside the cues element.
+ * Opus packet stored inside the payload of a cluster.
  */
-struct CuePoint {
+struct Packet {
 	/**
-	 * Position of the related cluster element, in global space.
+	 * Offset of the packet inside `Cluster::data`, in bytes.
 	 */
-	uint64_t pos;
+	uint32_t offset;
 
 	/**
-	 * Timestamp of this cue point, in seconds.
+	 * Size of the packet, in bytes.
 	 */
-	double time;
+	uint32_t size;
 
 	/**
-	 * Duration of this cue point, in seconds.
+	 * Timecode of the packet relative to its cluster, in time scale units.
 	 */
-	double duration;
+	int16_t timecode;
+};
+
+/**
+ * Audio packets of a single cluster. The payloads of every packet are stored back to back in one allocation, with
+ * block headers and other tracks already stripped. Only the last loaded cluster grows, with the context locked.
+ */
+struct Cluster {
+	/**
+	 * Position of the cluster element, in global space.
+	 */
+	uint64_t pos = 0;
+
+	/**
+	 * Timecode of the cluster, in time scale units.
+	 */
+	uint64_t timecode = 0;
 
-	CuePoint(const uint64_t p_pos, const double p_time, const double p_duration);
-	virtual ~CuePoint();
+	std::vector<uint8_t> data;
+	std::vector<Packet> packets;
+
+	/**
+	 * Whether the cluster was read from a block in its middle, so the packets before it are missing.
+	 */
+	bool partial = false;
+
+	/**
+	 * Whether the load thread is still appending packets. They can be decoded as soon as they are appended.
+	 */
+	bool loading = false;
+};
+
+/**
+ * Position and timecode of every audio block of a cluster, recorded while reading it from the start. It is kept after
+ * the cluster is dropped, so that seeking into the cluster again only reads from the block that is needed.
+ */
+struct BlockIndex {
+	/**
+	 * Timecode of the cluster, in time scale units.
+	 */
+	uint64_t timecode = 0;
+
+	/**
+	 * Position of each block element, in global space.
+	 */
+	std::vector<uint64_t> positions;
+
+	/**
+	 * Timecode of each block relative to the cluster, in time scale units.
+	 */
+	std::vector<int16_t> timecodes;
+};
+
+/**
+ * How far ahead of playback clusters are loaded.
+ */
+struct PrefetchPolicy {
+	enum Mode {
+		// Size the look ahead from the measured bandwidth of the stream, so that a download rarely outlasts it.
+		PREFETCH_ADAPTIVE,
+		// Always look `time` seconds ahead.
+		PREFETCH_FIXED
+	};
+
+	Mode mode = PREFETCH_ADAPTIVE;
+
+	/**
+	 * Seconds to look ahead in the fixed mode, and in the adaptive mode until the bandwidth is known.
+	 */
+	double time = 10.0;
+
+	/**
+	 * Seconds the adaptive mode looks ahead at least.
+	 */
+	double min_time = 2.0;
+
+	/**
+	 * Bytes of the stream the adaptive mode may load ahead, unless that is less than `min_time`.
+	 */
+	uint64_t memory_cap = 8000000;
 };
 
 /**
  * Manages parsing, decoding, sampling, and seeking of an opus audio track inside a webm container.
+ *
+ * Clusters are loaded on one thread and decoded ahead of playback on another. `sample` only copies already decoded
+ * audio out of a lock-free ring buffer, so it never waits on either of them.
  */
 class Decoder : public audio::Decoder {
 	ebml::Stream *const stream;
+	const PrefetchPolicy prefetch_policy;
 
-	bool terminate_thread = false;
+	std::atomic<bool> terminate_thread{ false };
 	std::thread thread;
+	std::thread decode_thread;
 
-	double position = 0.0;
+	// Playback position, written by `sample` and `seek` and read by the decoder threads to plan their wake ups.
+	std::atomic<double> position{ 0.0 };
 
 	struct DecoderContext {
-		bool ready = false;
+		std::atomic<bool> ready{ false };
 		uint64_t sample_attempts = 0;
 
 		uint64_t time_scale;
@@ -53,33 +142,105 @@ class Decoder : public audio::Decoder {
 		uint64_t track;
 		double sampling_rate;
 		uint64_t channels;
-		std::vector<CuePoint> cues;
 
-		OpusDecoder *opus;
+		// Clusters that can be seeked to. Only the load thread adds to it, with the mutex locked, and only the load
+		// thread reads it without locking.
+		SeekIndex seek_index;
+
+		// Average size of a second of the stream, in bytes.
+		double byte_rate;
+
+		OpusDecoder *opus = nullptr;
 		uint64_t opus_frame_samples;
 		float *opus_pcm = nullptr;
-		uint64_t opus_pcm_index = 0;
-		uint64_t opus_pcm_size = 0;
 
 		std::mutex mutex;
-		std::vector<std::vector<const ebml::Element *>> clusters;
+		std::condition_variable condition;
+		std::vector<Cluster> clusters;
 		uint64_t current_cluster = 0;
 		uint64_t active_cluster = 0;
-		uint64_t active_block = 0;
+		uint64_t active_packet = 0;
+
+		// Decoded samples to drop before the time of the last seek, so that playback starts exactly at it.
+		uint64_t skip_samples = 0;
+
+		// Seek generation that the cluster cursor above is positioned for.
+		uint64_t generation = 0;
 
-		void delete_cluster(const std::vector<const ebml::Element *> &p_cluster);
 		void trim_clusters();
 
 		DecoderContext();
 		virtual ~DecoderContext();
 	} context;
 
+	// Position of the cues element while it is not loaded yet, or zero, and of the data of the segment that the cues
+	// are relative to. Only used by the load thread.
+	uint64_t cues_pos = 0;
+	uint64_t segment_pos = 0;
+
+	// Block indices of the clusters read so far, keyed by cluster position. Only used by the load thread.
+	std::map<uint64_t, BlockIndex> block_indices;
+
 	struct {
 		std::mutex mutex;
+		std::condition_variable condition;
 		double time = 0.0;
 		bool job = true;
+		std::atomic<uint64_t> generation{ 1 };
+
+		// Playback position at which the idle load thread wants to be woken up to load the next cluster.
+		std::atomic<double> load_time{ INFINITY };
 	} seeking;
 
+	// Audio and opus states of recently decoded clusters. Only used with the context locked.
+	PcmCache pcm_cache;
+
+	// Called by the decode thread when less than `time` seconds are loaded ahead of playback. Only used with the
+	// context locked.
+	struct {
+		double time = 0.0;
+		std::function<void()> callback;
+	} drain;
+
+	/**
+	 * Where the opus state is in the stream. Only used by the decode thread.
+	 */
+	struct {
+		bool valid = false;
+
+		// Position of the cluster, and the packet of it that the state is ready to decode.
+		uint64_t cluster = 0;
+		uint64_t packet = 0;
+
+		// Samples to decode before the state sounds like a decode from the start of the stream, after a reset.
+		uint64_t unsettled_samples = 0;
+	} codec;
+
+	/**
+	 * Decoded audio, written by the decode thread and read by `sample`.
+	 */
+	struct {
+		// Interleaved stereo samples.
+		audio::RingBuffer<float> buffer;
+
+		// Seek generation of the samples written after `flush_pos`. Anything before it is stale.
+		std::atomic<uint64_t> generation{ 0 };
+		std::atomic<uint64_t> flush_pos{ 0 };
+
+		// Whether the decode thread has reached the end of the stream for this generation.
+		std::atomic<bool> finished{ false };
+
+		// Set by `sample` with the context locked once playback drained half of the buffer, and cleared by the decode
+		// thread when it sleeps on a full buffer.
+		std::atomic<bool> drained{ false };
+	} pcm;
+
+	enum DecodeResult {
+		DECODE_OK,
+		DECODE_WAITING,
+		DECODE_FINISHED
+	};
+
 protected:
 	void debug_print_element(const ebml::Element *const p_element);
 
@@ -87,9 +248,78 @@ protected:
 
 	void load_headers();
 
+	/**
+	 * Add the cues to the seek index. Failing to read them is not fatal, seeking only gets slower.
+	 */
+	void load_cues();
+
+	void wake_threads();
+
+	/**
+	 * Assumes the context is locked.
+	 *
+	 * @returns The time at which the loaded clusters run out, or infinity if every remaining cluster is loaded.
+	 */
+	double find_loaded_until() const;
+
+	/**
+	 * @returns How many seconds before playback reaches the cluster at `p_index` in the seek index it should be loaded.
+	 */
+	double get_prefetch_time(const uint64_t p_index);
+
+	/**
+	 * Read the timecode of the cluster at `p_pos`.
+	 *
+	 * @returns Whether a cluster starting with its timecode is there.
+	 */
+	bool read_cluster_time(const uint64_t p_pos, double &r_time);
+
+	/**
+	 * Scan the bytes in [`p_from`, `p_to`) for the first cluster.
+	 *
+	 * @param[out] r_pos The position of the cluster element.
+	 * @param[out] r_time The timestamp of the cluster, in seconds.
+	 * @returns Whether a cluster was found.
+	 */
+	bool find_cluster(const uint64_t p_from, const uint64_t p_to, uint64_t &r_pos, double &r_time);
+
+	/**
+	 * Add a cluster to the seek index, keeping the loaded clusters pointed at the same entries. Assumes the context
+	 * is locked.
+	 *
+	 * @returns The index of the cluster.
+	 */
+	uint64_t index_cluster(const uint64_t p_pos, const double p_time, const uint64_t p_relative_pos = 0, const uint64_t p_block_number = 0);
+
 	static void _thread_func(void *p_self);
 	void thread_func();
 
+	double get_packet_time(const uint64_t p_cluster_timecode, const int16_t p_timecode) const;
+
+	/**
+	 * Decode a packet into `context.opus_pcm`. Assumes the context is locked.
+	 *
+	 * @param[out] r_samples Number of samples per channel decoded.
+	 * @returns Whether the packet could be decoded.
+	 */
+	bool decode_opus(const Cluster &p_cluster, const uint64_t p_packet, uint64_t &r_samples);
+
+	/**
+	 * @returns Whether the opus state is ready to decode packet `p_packet` of `p_cluster`, the active cluster.
+	 */
+	bool is_synced(const Cluster &p_cluster, const uint64_t p_packet) const;
+
+	/**
+	 * Bring the opus state to the start of packet `p_packet` of `p_cluster`, from the saved state of the cluster if
+	 * there is one, or from a reset and a pre-roll. Assumes the context is locked.
+	 */
+	void sync_codec(const Cluster &p_cluster, const uint64_t p_packet);
+
+	DecodeResult decode_packet();
+
+	static void _decode_thread_func(void *p_self);
+	void decode_thread_func();
+
 public:
 	virtual double get_sample_rate() const;
 	virtual double get_duration() const;
@@ -98,7 +328,27 @@ public:
 	virtual void seek(const double p_time);
 	virtual void sample(audio::AudioFrame *const p_buffer, const uint64_t p_frames, bool &r_active, bool &r_buffering);
 
-	Decoder(ebml::Stream *const p_stream);
+	/**
+	 * @returns The time at which the loaded clusters run out, or infinity if every remaining cluster is loaded.
+	 */
+	double get_loaded_until();
+
+	/**
+	 * Only meaningful on the thread that calls `sample`.
+	 *
+	 * @returns Whether audio for the last seek is decoded, so that `sample` would not play silence.
+	 */
+	bool has_decoded_audio() const;
+
+	/**
+	 * Call `p_callback` whenever the decode thread finds less than `p_time` seconds loaded ahead of playback. That
+	 * only happens while playback advances, at most every time it drains half of the decoded audio.
+	 *
+	 * The callback runs on the decode thread without any lock of the decoder held, and must not block for long.
+	 */
+	void set_drain_callback(const double p_time, const std::function<void()> &p_callback);
+
+	Decoder(ebml::Stream *const p_stream, const PrefetchPolicy &p_prefetch_policy = PrefetchPolicy(), const PcmCachePolicy &p_pcm_cache_policy = PcmCachePolicy());
 	virtual ~Decoder();
 };
 }; // namespace webm
@@ -0,0 +1,117 @@
+#include "pcm_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+uint64_t webm::PcmCache::_get_size(const Entry &p_entry) const {
+	return p_entry.state.size() + p_entry.samples.size() * sizeof(float) + p_entry.compact_samples.size() * sizeof(int16_t) + p_entry.packet_ends.size() * sizeof(uint32_t);
+}
+
+void webm::PcmCache::_trim(const uint64_t p_keep) {
+	while (size > policy.budget) {
+		std::map<uint64_t, Entry>::iterator victim = entries.end();
+		for (std::map<uint64_t, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+			if (it->first == p_keep) {
+				continue;
+			}
+			if (victim == entries.end() || it->second.last_access < victim->second.last_access) {
+				victim = it;
+			}
+		}
+
+		if (victim == entries.end()) {
+			return;
+		}
+
+		size -= _get_size(victim->second);
+		entries.erase(victim);
+	}
+}
+
+void webm::PcmCache::store_state(const uint64_t p_cluster, const OpusDecoder *const p_opus) {
+	if (policy.budget == 0 || entries.count(p_cluster) != 0) {
+		return;
+	}
+
+	Entry &entry = entries[p_cluster];
+	entry.state.resize(opus_decoder_get_size(channels));
+	memcpy(entry.state.data(), p_opus, entry.state.size());
+	entry.last_access = ++access_count;
+
+	size += _get_size(entry);
+	_trim(p_cluster);
+}
+
+bool webm::PcmCache::has_state(const uint64_t p_cluster) const {
+	return entries.count(p_cluster) != 0;
+}
+
+bool webm::PcmCache::restore_state(const uint64_t p_cluster, OpusDecoder *const p_opus) {
+	const std::map<uint64_t, Entry>::iterator found = entries.find(p_cluster);
+	if (found == entries.end()) {
+		return false;
+	}
+
+	memcpy(p_opus, found->second.state.data(), found->second.state.size());
+	found->second.last_access = ++access_count;
+	return true;
+}
+
+void webm::PcmCache::store_packet(const uint64_t p_cluster, const uint64_t p_packet, const float *const p_pcm, const uint64_t p_frames) {
+	const std::map<uint64_t, Entry>::iterator found = entries.find(p_cluster);
+	if (found == entries.end() || found->second.packet_ends.size() != p_packet) {
+		return;
+	}
+
+	Entry &entry = found->second;
+	const uint64_t count = p_frames * channels;
+	const uint64_t before = _get_size(entry);
+
+	if (policy.compact) {
+		const uint64_t offset = entry.compact_samples.size();
+		entry.compact_samples.resize(offset + count);
+		for (uint64_t i = 0; i < count; ++i) {
+			const float sample = std::min(std::max(p_pcm[i], -1.0f), 1.0f);
+			entry.compact_samples[offset + i] = int16_t(sample * 32767.0f);
+		}
+		entry.packet_ends.push_back(entry.compact_samples.size() / channels);
+	} else {
+		entry.samples.insert(entry.samples.end(), p_pcm, p_pcm + count);
+		entry.packet_ends.push_back(entry.samples.size() / channels);
+	}
+	entry.last_access = ++access_count;
+
+	size += _get_size(entry) - before;
+	_trim(p_cluster);
+}
+
+bool webm::PcmCache::read_packet(const uint64_t p_cluster, const uint64_t p_packet, float *const r_pcm, uint64_t &r_frames) {
+	const std::map<uint64_t, Entry>::iterator found = entries.find(p_cluster);
+	if (found == entries.end() || p_packet >= found->second.packet_ends.size()) {
+		return false;
+	}
+
+	Entry &entry = found->second;
+	const uint64_t from = p_packet == 0 ? 0 : entry.packet_ends[p_packet - 1];
+	r_frames = entry.packet_ends[p_packet] - from;
+
+	if (policy.compact) {
+		const int16_t *const samples = entry.compact_samples.data() + from * channels;
+		for (uint64_t i = 0; i < r_frames * channels; ++i) {
+			r_pcm[i] = samples[i] / 32767.0f;
+		}
+	} else {
+		memcpy(r_pcm, entry.samples.data() + from * channels, r_frames * channels * sizeof(float));
+	}
+	entry.last_access = ++access_count;
+	return true;
+}
+
+void webm::PcmCache::clear() {
+	entries.clear();
+	size = 0;
+}
+
+webm::PcmCache::PcmCache(const PcmCachePolicy &p_policy, const uint64_t p_channels) :
+		policy(p_policy), channels(p_channels) {
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <opus/opus.h>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace webm {
+/**
+ * How much decoded audio is kept to resume from after seeking back.
+ */
+struct PcmCachePolicy {
+	/**
+	 * Bytes of decoded audio and decoder states to keep. Zero disables the cache.
+	 */
+	uint64_t budget = 16000000;
+
+	/**
+	 * Store samples as 16 bit integers instead of floats, which halves their memory at a small loss of precision.
+	 */
+	bool compact = false;
+};
+
+/**
+ * Recently decoded audio, keyed by the position of the cluster it was decoded from.
+ *
+ * Each cluster has the opus state at its start, and the audio of its first packets. The state lets decoding resume
+ * at the cluster without a pre-roll, and the audio lets playback resume without decoding at all. The least recently
+ * used clusters are evicted when the cache goes over its budget.
+ */
+class PcmCache {
+	struct Entry {
+		std::vector<uint8_t> state;
+
+		// Interleaved samples of the cached packets, in the format chosen by the policy.
+		std::vector<float> samples;
+		std::vector<int16_t> compact_samples;
+
+		// Frame at which each cached packet ends.
+		std::vector<uint32_t> packet_ends;
+
+		uint64_t last_access = 0;
+	};
+
+	const PcmCachePolicy policy;
+	const uint64_t channels;
+
+	std::map<uint64_t, Entry> entries;
+	uint64_t size = 0;
+	uint64_t access_count = 0;
+
+	uint64_t _get_size(const Entry &p_entry) const;
+
+	/**
+	 * Evict the least recently used clusters until the cache fits in its budget. The cluster at `p_keep` stays.
+	 */
+	void _trim(const uint64_t p_keep);
+
+public:
+	/**
+	 * Save the opus state at the start of the cluster at `p_cluster`, unless it is already saved.
+	 */
+	void store_state(const uint64_t p_cluster, const OpusDecoder *const p_opus);
+
+	/**
+	 * @returns Whether the opus state at the start of the cluster at `p_cluster` is saved.
+	 */
+	bool has_state(const uint64_t p_cluster) const;
+
+	/**
+	 * Restore the opus state at the start of the cluster at `p_cluster`.
+	 *
+	 * @returns Whether the state was saved.
+	 */
+	bool restore_state(const uint64_t p_cluster, OpusDecoder *const p_opus);
+
+	/**
+	 * Save the audio of a packet. Only the packet right after those already cached is kept, so that every cached
+	 * packet was decoded from the saved state.
+	 *
+	 * @param[in] p_pcm Interleaved samples of the packet.
+	 * @param[in] p_frames Number of frames in `p_pcm`.
+	 */
+	void store_packet(const uint64_t p_cluster, const uint64_t p_packet, const float *const p_pcm, const uint64_t p_frames);
+
+	/**
+	 * Copy the audio of a packet into `r_pcm`, which must fit the largest packet.
+	 *
+	 * @param[out] r_frames Number of frames copied.
+	 * @returns Whether the packet was cached.
+	 */
+	bool read_packet(const uint64_t p_cluster, const uint64_t p_packet, float *const r_pcm, uint64_t &r_frames);
+
+	void clear();
+
+	PcmCache(const PcmCachePolicy &p_policy, const uint64_t p_channels);
+};
+}; // namespace webm
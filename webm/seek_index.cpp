@@ -0,0 +1,60 @@
+#include "seek_index.hpp"
+
+#include <algorithm>
+
+uint64_t webm::SeekIndex::size() const {
+	return positions.size();
+}
+
+bool webm::SeekIndex::empty() const {
+	return positions.empty();
+}
+
+void webm::SeekIndex::reserve(const uint64_t p_count) {
+	times.reserve(p_count);
+	positions.reserve(p_count);
+	relative_positions.reserve(p_count);
+	block_numbers.reserve(p_count);
+}
+
+double webm::SeekIndex::get_time(const uint64_t p_index) const {
+	return times[p_index];
+}
+
+uint64_t webm::SeekIndex::get_pos(const uint64_t p_index) const {
+	return positions[p_index];
+}
+
+uint64_t webm::SeekIndex::get_relative_pos(const uint64_t p_index) const {
+	return relative_positions[p_index];
+}
+
+uint64_t webm::SeekIndex::get_block_number(const uint64_t p_index) const {
+	return block_numbers[p_index];
+}
+
+uint64_t webm::SeekIndex::find(const double p_time) const {
+	const std::vector<double>::const_iterator after = std::upper_bound(times.begin(), times.end(), p_time);
+	return after == times.begin() ? 0 : after - times.begin() - 1;
+}
+
+uint64_t webm::SeekIndex::insert(const uint64_t p_pos, const double p_time, const uint64_t p_relative_pos, const uint64_t p_block_number) {
+	const std::vector<uint64_t>::iterator at = std::lower_bound(positions.begin(), positions.end(), p_pos);
+	const uint64_t index = at - positions.begin();
+	if (at != positions.end() && *at == p_pos) {
+		// A cluster found by reading the stream gets the block position once the cues are loaded. The time of a cue is
+		// the time of that block, so it has to come along.
+		if (relative_positions[index] == 0 && p_relative_pos != 0) {
+			times[index] = p_time;
+			relative_positions[index] = p_relative_pos;
+			block_numbers[index] = p_block_number;
+		}
+		return index;
+	}
+
+	times.insert(times.begin() + index, p_time);
+	positions.insert(at, p_pos);
+	relative_positions.insert(relative_positions.begin() + index, p_relative_pos);
+	block_numbers.insert(block_numbers.begin() + index, p_block_number);
+	return index;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace webm {
+/**
+ * Times and positions of the clusters of a stream, in the order they appear in.
+ *
+ * Entries come from the cues, and from clusters found while reading or probing the stream, so the index may be sparse.
+ * Every field lives in its own array, so that a search only touches the times.
+ */
+class SeekIndex {
+	// Timestamp of each cluster, in seconds.
+	std::vector<double> times;
+
+	// Position of each cluster element, in global space.
+	std::vector<uint64_t> positions;
+
+	// Position of the block a cue references relative to the data of its cluster, and the number of that block
+	// starting at one. Zero where the cues do not say.
+	std::vector<uint64_t> relative_positions;
+	std::vector<uint64_t> block_numbers;
+
+public:
+	uint64_t size() const;
+	bool empty() const;
+	void reserve(const uint64_t p_count);
+
+	double get_time(const uint64_t p_index) const;
+	uint64_t get_pos(const uint64_t p_index) const;
+	uint64_t get_relative_pos(const uint64_t p_index) const;
+	uint64_t get_block_number(const uint64_t p_index) const;
+
+	/**
+	 * @returns The index of the last entry at or before `p_time`, or zero if every entry is after it.
+	 */
+	uint64_t find(const double p_time) const;
+
+	/**
+	 * Add the cluster at `p_pos`, unless it is already known. A known cluster only takes the block position, if it did
+	 * not have one.
+	 *
+	 * @returns The index of the entry.
+	 */
+	uint64_t insert(const uint64_t p_pos, const double p_time, const uint64_t p_relative_pos = 0, const uint64_t p_block_number = 0);
+};
+}; // namespace webm
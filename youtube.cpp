@@ -3,12 +3,28 @@
 #include "http_stream.hpp"
 #include "local_stream.hpp"
 
-#include "core/io/http_client.h"
 #include "core/io/json.h"
-#include "core/os/dir_access.h"
 #include "core/os/file_access.h"
 #include "modules/regex/regex.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Seconds playback may run past the switch time before the rendition being switched to aims for a later one.
+static const double SWITCH_GRACE_TIME = 1.0;
+
+// Average bitrate of an adaptive format, in bits per second.
+static int64_t get_format_bitrate(const Variant &p_format) {
+	bool valid;
+	const int64_t average = p_format.get("averageBitrate", &valid);
+	if (valid && average > 0) {
+		return average;
+	}
+	return p_format.get("bitrate");
+}
+
 String regex_match(const String &p_regex, const String &p_string, const uint64_t p_group = 1) {
 	RegEx regex;
 	const Error err = regex.compile(p_regex);
@@ -46,7 +62,6 @@ bool _fetch_player_response(const String p_id, yt::PlayerResponse &r_response, c
 			yt::YOUTUBE_HOST,
 			path,
 			"",
-			"",
 			yt::DEFAULT_HEADERS,
 			p_terminate_threads);
 
@@ -120,150 +135,134 @@ String yt::YouTube::request(
 		const String p_host,
 		const String p_path,
 		const String p_body,
-		const String p_file,
 		const Vector<String> p_headers,
 		const bool *p_terminate_threads) {
-	HTTPClient client;
+	// Redirects are followed on the connection of their host, taken from the pool in place of the previous one.
+	String host = p_host;
+	String path = p_path;
+	std::unique_ptr<PooledClient> pooled(new PooledClient(*http_pool, host));
+	HttpConnection *client = pooled->client;
+	HttpReactor &reactor = http_pool->get_reactor();
+
+	// Let the reactor poll the connection while it is resolving, connecting or sending, instead of spinning here.
+	auto poll_while_busy = [&]() {
+		const HttpReactor::Step step = [&]() -> HttpReactor::StepResult {
+			const HttpConnection::Status status = client->get_status();
+			if (status != HttpConnection::STATUS_RESOLVING && status != HttpConnection::STATUS_CONNECTING && status != HttpConnection::STATUS_REQUESTING) {
+				return HttpReactor::STEP_DONE;
+			}
 
-	//print_verbose(String() + "Requesting at host '" + p_host + "', path '" + p_path + "', body '" + p_body + "', file '" + p_file + "'");
+			client->poll();
+			return client->get_status() != status ? HttpReactor::STEP_PROGRESS : HttpReactor::STEP_IDLE;
+		};
+		reactor.run(step);
+	};
+
+	//print_verbose(String() + "Requesting at host '" + p_host + "', path '" + p_path + "', body '" + p_body + "'");
 
 	if (p_terminate_threads == nullptr) {
 		p_terminate_threads = &terminate_threads;
 	}
 
-	const Error connect_err = client.connect_to_host(p_host);
-	ERR_FAIL_COND_V_MSG(connect_err != OK, "", "Failed to connect to the host.");
+	// Give up after this many redirects, as a loop of them would never end.
+	static const uint64_t MAX_REDIRECTS = 10;
+	uint64_t redirects = 0;
 
-	while (client.get_status() == HTTPClient::STATUS_RESOLVING || client.get_status() == HTTPClient::STATUS_CONNECTING) {
-		OS::get_singleton()->delay_usec(1);
-		client.poll();
-	}
+	// A connection kept alive by the pool may have been closed by the server since, so retry once on a new one.
+	bool reused = client->get_status() == HttpConnection::STATUS_CONNECTED;
+	while (true) {
+		if (client->get_status() != HttpConnection::STATUS_CONNECTED) {
+			const Error connect_err = client->connect_to_host(host);
+			ERR_FAIL_COND_V_MSG(connect_err != OK, "", "Failed to connect to the host.");
 
-	const bool connect_failed = client.get_status() != HTTPClient::STATUS_CONNECTED;
-	ERR_FAIL_COND_V_MSG(connect_failed, "", "Failed to connect to the host.");
+			poll_while_busy();
 
-	if (!p_body.empty()) {
-		const Error request_err = client.request(HTTPClient::METHOD_POST, p_path, p_headers, p_body);
-		ERR_FAIL_COND_V_MSG(request_err != OK, "", "Failed to perform request.");
-	} else {
-		const Error request_err = client.request(HTTPClient::METHOD_GET, p_path, p_headers);
-		ERR_FAIL_COND_V_MSG(request_err != OK, "", "Failed to perform request.");
-	}
+			const bool connect_failed = client->get_status() != HttpConnection::STATUS_CONNECTED;
+			ERR_FAIL_COND_V_MSG(connect_failed, "", "Failed to connect to the host.");
+		}
 
-	while (client.get_status() == HTTPClient::STATUS_REQUESTING) {
-		OS::get_singleton()->delay_usec(1);
-		client.poll();
-	}
+		if (!p_body.empty()) {
+			const Error request_err = client->request(HttpConnection::METHOD_POST, path, p_headers, p_body);
+			ERR_FAIL_COND_V_MSG(request_err != OK, "", "Failed to perform request.");
+		} else {
+			const Error request_err = client->request(HttpConnection::METHOD_GET, path, p_headers);
+			ERR_FAIL_COND_V_MSG(request_err != OK, "", "Failed to perform request.");
+		}
 
-	const bool request_failed = client.get_status() != HTTPClient::STATUS_BODY && client.get_status() != HTTPClient::STATUS_CONNECTED;
-	ERR_FAIL_COND_V_MSG(request_failed, "", "Failed to perform request.");
+		poll_while_busy();
 
-	if (client.has_response()) {
-		if (client.get_response_body_length() == 0) {
-			List<String> headers;
-			const Error headers_err = client.get_response_headers(&headers);
-			if (headers_err != OK) {
-				ERR_FAIL_V_MSG("", "Failed to read headers.");
-			}
+		const bool request_failed = client->get_status() != HttpConnection::STATUS_BODY && client->get_status() != HttpConnection::STATUS_CONNECTED;
+		if (request_failed) {
+			ERR_FAIL_COND_V_MSG(!reused, "", "Failed to perform request.");
+			client->close();
+			reused = false;
+			continue;
+		}
 
-			String redirect;
-			for (int i = 0; i < headers.size(); ++i) {
-				const String header = headers[i];
-				if (header.begins_with("Location: ")) {
-					redirect = header.substr(10);
-					client.close();
-					break;
-				}
-			}
+		if (!client->has_response() || client->get_response_code() / 100 != 3) {
+			break;
+		}
 
-			if (redirect.empty()) {
-				ERR_FAIL_V_MSG("", "Server replied with empty response.");
-			}
+		ERR_FAIL_COND_V_MSG(++redirects > MAX_REDIRECTS, "", "Too many redirects.");
 
-			if (redirect.begins_with("//")) {
-				redirect = redirect.insert(0, "https:");
-			} else if (redirect.begins_with("/")) {
-				redirect = redirect.insert(0, p_host);
-			}
+		String redirect = client->get_response_location();
+		if (redirect.empty()) {
+			ERR_FAIL_V_MSG("", "Server replied with empty response.");
+		}
 
-			String new_scheme, new_host, new_path;
-			int new_port;
-			const Error url_err = redirect.parse_url(new_scheme, new_host, new_port, new_path);
-			ERR_FAIL_COND_V_MSG(url_err != OK, "", "Failed to parse redirect url.");
+		if (redirect.begins_with("//")) {
+			redirect = redirect.insert(0, "https:");
+		} else if (redirect.begins_with("/")) {
+			redirect = redirect.insert(0, host);
+		}
 
-			if (!redirect.empty()) {
-				return request(new_scheme + new_host, new_path, p_body, p_file, p_headers);
-			}
+		String new_scheme, new_host;
+		int new_port;
+		const Error url_err = redirect.parse_url(new_scheme, new_host, new_port, path);
+		ERR_FAIL_COND_V_MSG(url_err != OK, "", "Failed to parse redirect url.");
 
-			ERR_FAIL_V_MSG("", "Response body length was zero.");
+		// Finish an empty body so that the connection can be kept, and give it back before taking one to the new host.
+		if (client->get_response_body_length() == 0) {
+			uint8_t none;
+			client->read_body(&none, 0);
 		}
+		pooled.reset();
 
-		if (p_file.empty()) {
-			// Download to a string.
-			PoolByteArray response;
-
-			while (client.get_status() == HTTPClient::STATUS_BODY) {
-				if (*p_terminate_threads) {
-					return "";
-				}
-				client.poll();
-				const PoolByteArray &chunk = client.read_response_body_chunk();
-				if (!chunk.empty()) {
-					const uint64_t pos = response.size();
-					response.resize(response.size() + chunk.size());
-					for (int i = 0; i < chunk.size(); ++i) {
-						response.set(pos + i, chunk[i]);
-					}
-				} else {
-					OS::get_singleton()->delay_usec(1);
-				}
-			}
+		host = new_scheme + new_host;
+		pooled.reset(new PooledClient(*http_pool, host));
+		client = pooled->client;
+		reused = client->get_status() == HttpConnection::STATUS_CONNECTED;
+	}
 
-			String text;
-			const PoolByteArray::Read r = response.read();
-			text.parse_utf8((const char *)r.ptr(), response.size());
+	if (client->has_response()) {
+		// Download to a string, receiving straight into the unused end of the buffer.
+		std::vector<uint8_t> response(MAX(client->get_response_body_length(), (int64_t)65536));
+		uint64_t filled = 0;
 
-			return text;
-		} else {
-			// Create directory.
-			DirAccess *const dir = DirAccess::create_for_path(p_file);
-			if (!dir->dir_exists(p_file.get_base_dir())) {
-				const Error dir_err = dir->make_dir_recursive(p_file.get_base_dir());
-				ERR_FAIL_COND_V_MSG(dir_err != OK, "", "Failed to create directory: '" + p_file.get_base_dir() + "'.");
+		const HttpReactor::Step receive = [&]() -> HttpReactor::StepResult {
+			if (*p_terminate_threads || client->get_status() != HttpConnection::STATUS_BODY) {
+				return HttpReactor::STEP_DONE;
 			}
-
-			// Create file.
-			const String tmp_file = p_file + ".part";
-
-			dir->remove(p_file);
-
-			Error file_err;
-			FileAccess *const file = FileAccess::open(tmp_file, FileAccess::WRITE, &file_err);
-			ERR_FAIL_COND_V_MSG(file_err != OK, "", "Failed to create file: '" + tmp_file + "'.");
-
-			// Download to a file.
-			while (client.get_status() == HTTPClient::STATUS_BODY) {
-				if (*p_terminate_threads) {
-					return "";
-				}
-				client.poll();
-				const PoolByteArray &chunk = client.read_response_body_chunk();
-				if (!chunk.empty()) {
-					const PoolByteArray::Read r = chunk.read();
-					file->store_buffer(r.ptr(), chunk.size());
-				} else {
-					OS::get_singleton()->delay_usec(1);
-				}
+			if (filled == response.size()) {
+				response.resize(response.size() * 2);
+			}
+			const uint64_t received = client->read_body(response.data() + filled, response.size() - filled);
+			if (received == 0) {
+				return HttpReactor::STEP_IDLE;
 			}
+			filled += received;
+			return HttpReactor::STEP_PROGRESS;
+		};
+		reactor.run(receive);
 
-			file->close();
-			memdelete(file);
+		if (*p_terminate_threads) {
+			return "";
+		}
 
-			const Error rename_err = dir->rename(tmp_file, p_file);
-			ERR_FAIL_COND_V_MSG(rename_err != OK, "", "Failed to rename file from '" + tmp_file + "' to '" + p_file + "'.");
+		String text;
+		text.parse_utf8((const char *)response.data(), filled);
 
-			memdelete(dir);
-		}
+		return text;
 	}
 
 	return "";
@@ -382,6 +381,15 @@ yt::YouTube *yt::YouTube::singleton;
 void yt::YouTube::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("search", "query"), &yt::YouTube::search);
 	ClassDB::bind_method(D_METHOD("get_video", "id"), &yt::YouTube::get_video);
+
+	ClassDB::bind_method(D_METHOD("set_parallel_chunk_size", "bytes"), &yt::YouTube::set_parallel_chunk_size);
+	ClassDB::bind_method(D_METHOD("get_parallel_chunk_size"), &yt::YouTube::get_parallel_chunk_size);
+
+	ClassDB::bind_method(D_METHOD("set_parallel_connections", "connections"), &yt::YouTube::set_parallel_connections);
+	ClassDB::bind_method(D_METHOD("get_parallel_connections"), &yt::YouTube::get_parallel_connections);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "parallel_chunk_size"), "set_parallel_chunk_size", "get_parallel_chunk_size");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "parallel_connections"), "set_parallel_connections", "get_parallel_connections");
 }
 
 void yt::YouTube::_thread_search(Ref<YouTubeSearchTask> p_task) {
@@ -410,7 +418,7 @@ void yt::YouTube::_thread_search(Ref<YouTubeSearchTask> p_task) {
 
 	const String body = JSON::print(get_body());
 
-	const String search_response_raw = request(yt::YOUTUBE_HOST, path, body, "", headers);
+	const String search_response_raw = request(yt::YOUTUBE_HOST, path, body, headers);
 
 	Variant search_response;
 	{
@@ -575,25 +583,88 @@ yt::YouTube *yt::YouTube::get_singleton() {
 	return singleton;
 }
 
-void yt::YouTube::_thread_download_cache(const String p_playback_url, const String p_local_path) {
-	String scheme, host, path;
-	int port;
-	const Error err = p_playback_url.parse_url(scheme, host, port, path);
-	ERR_FAIL_COND_MSG(err != OK, "Failed to parse playback url.");
+std::shared_ptr<HttpPool> yt::YouTube::get_http_pool() const {
+	return http_pool;
+}
 
-	request(scheme + host, path, "", p_local_path);
+std::shared_ptr<BandwidthEstimator> yt::YouTube::get_bandwidth_estimator() const {
+	return bandwidth_estimator;
 }
 
-void yt::YouTube::download_cache(const String p_playback_url, const String p_local_path) {
-	// Only download playback if we are not already downloading it.
-	static Set<String> downloading_cache;
-	if(!downloading_cache.has(p_local_path)) {
-		downloading_cache.insert(p_local_path);
-		task_threads.push_back(std::thread(&yt::YouTube::_thread_download_cache, this, p_playback_url, p_local_path));
+void yt::YouTube::set_parallel_chunk_size(const int64_t p_bytes) {
+	parallel_chunk_size = MAX(p_bytes, (int64_t)0);
+}
+
+int64_t yt::YouTube::get_parallel_chunk_size() const {
+	return parallel_chunk_size;
+}
+
+void yt::YouTube::set_parallel_connections(const int64_t p_connections) {
+	parallel_connections = MAX(p_connections, (int64_t)1);
+}
+
+int64_t yt::YouTube::get_parallel_connections() const {
+	return parallel_connections;
+}
+
+std::shared_ptr<CacheFile> yt::YouTube::open_cache_file(const String p_local_path) {
+	MutexLock lock(cache_files_mutex);
+
+	std::shared_ptr<CacheFile> file = cache_files[p_local_path].lock();
+	if (!file) {
+		file = std::make_shared<CacheFile>(p_local_path);
+		cache_files[p_local_path] = file;
 	}
+
+	return file;
 }
 
-yt::YouTube::YouTube() {
+void yt::YouTube::_thread_backfill_cache(const String p_playback_url, const std::shared_ptr<CacheFile> p_file) {
+	// Nobody is waiting for these bytes, so download them as fast as the connection allows.
+	static const uint64_t BACKFILL_CHUNK_SIZE = 1000000;
+	static const uint64_t BACKFILL_CONNECTIONS = 4;
+	// Bytes preloaded at once.
+	static const uint64_t BACKFILL_STEP = BACKFILL_CHUNK_SIZE * BACKFILL_CONNECTIONS;
+
+	// Only the chunks in flight need to stay in memory, the bytes go to disk through the cache file.
+	HttpStream stream(p_playback_url, BACKFILL_STEP * 2, http_pool);
+	stream.set_parallel(BACKFILL_CHUNK_SIZE, BACKFILL_CONNECTIONS);
+	stream.set_disk_cache(p_file);
+	stream.set_estimator(bandwidth_estimator);
+	// Quitting does not wait for the step being downloaded.
+	stream.set_cancel_flag(&terminate_threads);
+
+	if (!p_file->get_has_length()) {
+		stream.get_length();
+	}
+
+	const std::vector<std::pair<uint64_t, uint64_t>> missing = p_file->get_missing();
+	for (const std::pair<uint64_t, uint64_t> &gap : missing) {
+		for (uint64_t pos = gap.first; pos < gap.second; pos += BACKFILL_STEP) {
+			if (terminate_threads) {
+				return;
+			}
+
+			const bool preloaded = stream.preload(pos, MIN(pos + BACKFILL_STEP, gap.second));
+			if (terminate_threads) {
+				return;
+			}
+			ERR_FAIL_COND_MSG(!preloaded, "Failed to backfill cache file '" + p_file->get_path() + "'.");
+		}
+	}
+}
+
+void yt::YouTube::backfill_cache(const String p_playback_url, const std::shared_ptr<CacheFile> p_file) {
+	if (p_file->is_finished() || !p_file->claim_backfill()) {
+		return;
+	}
+
+	task_threads.push_back(std::thread(&yt::YouTube::_thread_backfill_cache, this, p_playback_url, p_file));
+}
+
+yt::YouTube::YouTube() :
+		http_pool(std::make_shared<HttpPool>()),
+		bandwidth_estimator(std::make_shared<BandwidthEstimator>()) {
 	singleton = this;
 }
 
@@ -613,7 +684,6 @@ void yt::Player::_thread_func() {
 				YOUTUBE_HOST,
 				p_player.player_url,
 				"",
-				"",
 				yt::DEFAULT_HEADERS,
 				&terminate_thread);
 
@@ -678,27 +748,27 @@ void yt::Player::_thread_func() {
 		}
 	};
 
-	auto parse_playback_url = [&](const PlayerResponse &p_player) -> String {
+	// Opus renditions, from the lowest bitrate to the highest.
+	auto parse_formats = [&](const PlayerResponse &p_player, std::vector<Variant> &r_formats) {
 		const Array formats = p_player.player_response.get("streamingData").get("adaptiveFormats");
-
-		Variant best_format;
-		uint64_t best_bitrate = 0;
 		for (int i = 0; i < formats.size(); ++i) {
 			const Variant format = formats[i];
 			if (format.get("mimeType") == "audio/webm; codecs=\"opus\"") {
-				uint64_t bitrate = format.get("bitrate");
-				if (bitrate > best_bitrate) {
-					best_format = format;
-					best_bitrate = bitrate;
-				}
+				r_formats.push_back(format);
 			}
 		}
 
+		std::sort(r_formats.begin(), r_formats.end(), [](const Variant &p_a, const Variant &p_b) {
+			return get_format_bitrate(p_a) < get_format_bitrate(p_b);
+		});
+	};
+
+	auto parse_playback_url = [&](const PlayerResponse &p_player, const Variant &p_format) -> String {
 		bool valid;
-		String playback_url = best_format.get("url", &valid);
+		String playback_url = p_format.get("url", &valid);
 		if (!valid) {
 			auto get_cipher_data = [&]() -> Dictionary {
-				const String raw = best_format.get("signatureCipher");
+				const String raw = p_format.get("signatureCipher");
 				const Vector<String> elements = raw.split("&");
 				Dictionary dict;
 				for (int i = 0; i < elements.size(); ++i) {
@@ -766,13 +836,179 @@ void yt::Player::_thread_func() {
 		return;
 	}
 
-	const String playback_url = parse_playback_url(response);
+	// Byte range of the format as "{ start: "0", end: "258" }", with an inclusive end.
+	auto parse_range = [](const Variant p_range, uint64_t &r_start, uint64_t &r_end) -> bool {
+		bool start_valid, end_valid;
+		const String start = p_range.get("start", &start_valid);
+		const String end = p_range.get("end", &end_valid);
+		if (!start_valid || !end_valid) {
+			return false;
+		}
+
+		r_start = start.to_int64();
+		r_end = end.to_int64() + 1;
+		return r_end > r_start;
+	};
+
+	auto open_stream = [&](const Variant &p_format, const String &p_url, const std::shared_ptr<CacheFile> &p_disk_cache) -> HttpStream * {
+		HttpStream *const stream = new HttpStream(p_url, HttpStream::DEFAULT_CACHE_BUDGET, YouTube::get_singleton()->get_http_pool());
+		stream->set_disk_cache(p_disk_cache);
+		stream->set_estimator(YouTube::get_singleton()->get_bandwidth_estimator());
+		stream->set_parallel(YouTube::get_singleton()->get_parallel_chunk_size(), YouTube::get_singleton()->get_parallel_connections());
+
+		bool length_valid;
+		const String content_length = p_format.get("contentLength", &length_valid);
+		if (length_valid) {
+			stream->set_length(content_length.to_int64());
+		}
+
+		// The init range holds the headers and the index range holds the cues. Fetching the headers with an exact
+		// request means the decoder parses them from memory. The cues are only needed to seek and the decoder loads
+		// them once playback has started, so they are only fetched up front when they come with the headers.
+
+		// Fetch both with one request if the bytes in between are not worth a second round trip.
+		static const uint64_t MERGE_GAP = 65536;
 
-	playback.stream = new HttpStream(playback_url);
-	playback.decoder = new webm::Decoder(playback.stream);
+		uint64_t init_start, init_end, index_start, index_end;
+		const bool has_init = parse_range(p_format.get("initRange"), init_start, init_end);
+		const bool has_index = parse_range(p_format.get("indexRange"), index_start, index_end);
+
+		if (has_init && has_index && index_start >= init_start && index_start <= init_end + MERGE_GAP) {
+			stream->preload(init_start, MAX(init_end, index_end));
+		} else if (has_init) {
+			stream->preload(init_start, init_end);
+		}
+
+		return stream;
+	};
+
+	std::vector<Variant> formats;
+	parse_formats(response, formats);
+	ERR_FAIL_COND_MSG(formats.empty(), "Video has no opus audio format.");
+
+	uint64_t format_index = _select_format(formats);
+	playback_url = parse_playback_url(response, formats[format_index]);
+	cache_file = YouTube::get_singleton()->open_cache_file(local_path);
+
+	// Bytes fetched for playback are written to the disk cache, so the video is only downloaded once.
+	playback.stream = open_stream(formats[format_index], playback_url, cache_file);
+	playback.decoder = new webm::Decoder(playback.stream, prefetch_policy, pcm_cache_policy);
 	playback.ready = true;
 
-	YouTube::get_singleton()->download_cache(playback_url, local_path);
+	// Only adaptive playback switches renditions, and only to a lower bitrate.
+	if (format_policy.mode != FormatPolicy::FORMAT_ADAPTIVE || format_index == 0) {
+		return;
+	}
+
+	// Move to a lower bitrate when fewer seconds than this are loaded ahead of playback.
+	static const double DRAINED_TIME = 2.0;
+
+	auto watch_drain = [&](webm::Decoder *const p_decoder) {
+		p_decoder->set_drain_callback(DRAINED_TIME, [this]() { _wake_thread(); });
+	};
+	watch_drain(playback.decoder);
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			while (!terminate_thread && !wake) {
+				wake_condition.wait(lock);
+			}
+			if (terminate_thread) {
+				return;
+			}
+			wake = false;
+		}
+
+		if (switched) {
+			// `sample` swapped the renditions, so `next` holds the one that is not played anymore. It is only used while
+			// `has_next` is set, which is cleared first.
+			std::lock_guard<std::mutex> lock(switch_mutex);
+			has_next = false;
+			next.clear();
+			switched = false;
+			switched_down = true;
+
+			if (format_index == 0) {
+				// There is no lower bitrate left to switch to.
+				return;
+			}
+			watch_drain(playback.decoder);
+			continue;
+		}
+
+		if (has_next) {
+			// Playback went past the boundary before the new rendition was ready, so aim for the next boundary.
+			std::lock_guard<std::mutex> lock(switch_mutex);
+
+			const double position = playback.decoder->get_position();
+			if (position > switch_time + SWITCH_GRACE_TIME) {
+				const double loaded_until = playback.decoder->get_loaded_until();
+				const double boundary = std::isinf(loaded_until) ? position : loaded_until;
+				next.decoder->seek(boundary);
+				switch_time = boundary;
+			}
+			continue;
+		}
+
+		const double loaded_until = playback.decoder->get_loaded_until();
+		if (loaded_until - playback.decoder->get_position() >= DRAINED_TIME) {
+			continue;
+		}
+
+		const uint64_t index = _select_format(formats);
+		if (index >= format_index) {
+			continue;
+		}
+
+		// The switched stream does not fill the disk cache, which holds the rendition playback started with.
+		const String url = parse_playback_url(response, formats[index]);
+		HttpStream *const stream = open_stream(formats[index], url, nullptr);
+		webm::Decoder *const decoder = new webm::Decoder(stream, prefetch_policy, pcm_cache_policy);
+
+		// The current rendition plays until its loaded clusters run out, and the new one takes over from there.
+		decoder->seek(loaded_until);
+
+		std::lock_guard<std::mutex> lock(switch_mutex);
+		next.stream = stream;
+		next.decoder = decoder;
+		switch_time = loaded_until;
+		has_next = true;
+		format_index = index;
+	}
+}
+
+uint64_t yt::Player::_select_format(const std::vector<Variant> &p_formats) const {
+	// A rendition is only sustained if the throughput leaves this much room above its bitrate.
+	static const double HEADROOM = 1.5;
+
+	const uint64_t highest = p_formats.size() - 1;
+	if (format_policy.mode == FormatPolicy::FORMAT_MAX_QUALITY) {
+		return highest;
+	}
+
+	uint64_t capped = highest;
+	if (format_policy.max_bitrate > 0) {
+		while (capped > 0 && get_format_bitrate(p_formats[capped]) > format_policy.max_bitrate) {
+			--capped;
+		}
+	}
+
+	if (format_policy.mode == FormatPolicy::FORMAT_CAPPED) {
+		return capped;
+	}
+
+	// Without a measurement yet, start with the best quality allowed.
+	const double rate = YouTube::get_singleton()->get_bandwidth_estimator()->get_safe_rate();
+	if (rate <= 0.0) {
+		return capped;
+	}
+
+	uint64_t index = capped;
+	while (index > 0 && get_format_bitrate(p_formats[index]) * HEADROOM > rate * 8.0) {
+		--index;
+	}
+	return index;
 }
 
 double yt::Player::get_sample_rate() const {
@@ -796,6 +1032,8 @@ double yt::Player::get_position() const {
 		return playback.start_pos;
 	}
 
+	std::lock_guard<std::mutex> lock(switch_mutex);
+
 	return playback.decoder->get_position();
 }
 
@@ -805,7 +1043,15 @@ void yt::Player::seek(const double p_time) {
 		return;
 	}
 
+	std::lock_guard<std::mutex> lock(switch_mutex);
+
 	playback.decoder->seek(p_time);
+
+	// Load the rendition being switched to from the same time, and switch as soon as it has audio.
+	if (has_next && !switched) {
+		next.decoder->seek(p_time);
+		switch_time = p_time;
+	}
 }
 
 void yt::Player::sample(
@@ -814,21 +1060,42 @@ void yt::Player::sample(
 		bool &r_active,
 		bool &r_buffering) {
 	if (!playback.ready) {
-		for (uint64_t i = 0; i < p_frames; ++i) {
-			p_buffer[i] = audio::AudioFrame();
-		}
+		memset(p_buffer, 0, p_frames * sizeof(audio::AudioFrame));
 		r_active = true;
 		r_buffering = true;
 		return;
 	}
 
+	if (has_next && !switched && playback.decoder->get_position() >= switch_time) {
+		// Never wait for the lock on the audio thread, the switch is tried again on the next mix. The rendition being
+		// switched to is only touched with the lock held, as the thread deletes it under the lock.
+		std::unique_lock<std::mutex> lock(switch_mutex, std::try_to_lock);
+		if (lock.owns_lock() && has_next && !switched && playback.decoder->get_position() >= switch_time && next.decoder->has_decoded_audio()) {
+			std::swap(playback.stream, next.stream);
+			std::swap(playback.decoder, next.decoder);
+			switched = true;
+		}
+	}
+
+	// The thread deletes what was swapped out, and aims for a later boundary when playback passed this one before the
+	// new rendition was ready. It is woken up with the same rule as the switch, until it takes notice.
+	const bool missed = has_next && !switched && playback.decoder->get_position() > switch_time + SWITCH_GRACE_TIME;
+	if ((switched || missed) && !wake) {
+		std::unique_lock<std::mutex> lock(wake_mutex, std::try_to_lock);
+		if (lock.owns_lock()) {
+			wake = true;
+			wake_condition.notify_one();
+		}
+	}
+
 	playback.decoder->sample(p_buffer, p_frames, r_active, r_buffering);
 }
 
-yt::Player::Player(const String p_id) : id(p_id) {
+yt::Player::Player(const String p_id, const webm::PrefetchPolicy &p_prefetch_policy, const FormatPolicy &p_format_policy, const webm::PcmCachePolicy &p_pcm_cache_policy) :
+		id(p_id), prefetch_policy(p_prefetch_policy), format_policy(p_format_policy), pcm_cache_policy(p_pcm_cache_policy) {
 	auto create_local_stream = [&]() {
 		playback.stream = new LocalStream(local_path);
-		playback.decoder = new webm::Decoder(playback.stream);
+		playback.decoder = new webm::Decoder(playback.stream, prefetch_policy, pcm_cache_policy);
 		playback.decoder->seek(playback.start_pos);
 		playback.ready = true;
 	};
@@ -839,9 +1106,27 @@ yt::Player::Player(const String p_id) : id(p_id) {
 	}
 }
 
+void yt::Player::_wake_thread() {
+	std::lock_guard<std::mutex> lock(wake_mutex);
+
+	wake = true;
+	wake_condition.notify_one();
+}
+
 yt::Player::~Player() {
-	terminate_thread = true;
-	if(thread.joinable()) {
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		terminate_thread = true;
+	}
+	wake_condition.notify_one();
+
+	if (thread.joinable()) {
 		thread.join();
 	}
+
+	// Download whatever was skipped or not played yet, so the next play reads from disk. After a switch to a lower
+	// bitrate, the link is too slow to spend on the higher bitrate rendition that the disk cache holds.
+	if (cache_file && !switched_down && YouTube::get_singleton() != nullptr) {
+		YouTube::get_singleton()->backfill_cache(playback_url, cache_file);
+	}
 }
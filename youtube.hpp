@@ -1,6 +1,9 @@
 #pragma once
 
 #include "audio/decoder.hpp"
+#include "bandwidth_estimator.hpp"
+#include "cache_file.hpp"
+#include "http_pool.hpp"
 #include "ebml/stream.hpp"
 #include "webm/decoder.hpp"
 
@@ -8,7 +11,12 @@
 #include "core/reference.h"
 #include "core/variant.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 
 namespace yt {
 static const char *const YOUTUBE_HOST = "https://www.youtube.com";
@@ -36,6 +44,28 @@ struct ScramblerFunction {
 static Mutex scrambler_cache_mutex;
 static std::vector<ScramblerFunction> scrambler_cache;
 
+/**
+ * Which opus rendition of a video is played.
+ */
+struct FormatPolicy {
+	enum Mode {
+		// The highest bitrate.
+		FORMAT_MAX_QUALITY,
+		// The highest bitrate up to `max_bitrate`.
+		FORMAT_CAPPED,
+		// The highest bitrate the measured throughput sustains, up to `max_bitrate` if it is set. Playback moves to a
+		// lower bitrate at a cluster boundary when its buffer drains.
+		FORMAT_ADAPTIVE
+	};
+
+	Mode mode = FORMAT_ADAPTIVE;
+
+	/**
+	 * In bits per second, or zero for no cap.
+	 */
+	int64_t max_bitrate = 0;
+};
+
 struct PlayerResponse {
 	String player_url;
 	Variant player_data;
@@ -114,17 +144,39 @@ class YouTube : public Object {
 	bool terminate_threads = false;
 	std::vector<std::thread> task_threads;
 
+	// Keep-alive connections shared by every request and playback stream.
+	std::shared_ptr<HttpPool> http_pool;
+
+	// Throughput of every playback stream, so that a new one starts from what the last ones measured.
+	std::shared_ptr<BandwidthEstimator> bandwidth_estimator;
+
+	// Playback streams download chunks of this size on several connections, unless it is zero.
+	int64_t parallel_chunk_size = 0;
+	int64_t parallel_connections = 4;
+
+	// Cache files being written, so that players of the same video share one.
+	Mutex cache_files_mutex;
+	std::map<String, std::weak_ptr<CacheFile>> cache_files;
+
 protected:
 	static void _bind_methods();
 
 public:
 	static YouTube *get_singleton();
 
+	std::shared_ptr<HttpPool> get_http_pool() const;
+	std::shared_ptr<BandwidthEstimator> get_bandwidth_estimator() const;
+
+	void set_parallel_chunk_size(const int64_t p_bytes);
+	int64_t get_parallel_chunk_size() const;
+
+	void set_parallel_connections(const int64_t p_connections);
+	int64_t get_parallel_connections() const;
+
 	String request(
 			const String p_host,
 			const String p_path,
 			const String p_body = String(),
-			const String p_file = String(),
 			const Vector<String> p_headers = DEFAULT_HEADERS,
 			const bool *p_terminate_threads = nullptr);
 
@@ -134,8 +186,17 @@ public:
 	void _thread_get_video(const Ref<YouTubeGetVideoTask> p_task);
 	Ref<YouTubeGetVideoTask> get_video(const String p_id);
 
-	void _thread_download_cache(const String p_playback_url, const String p_local_path);
-	void download_cache(const String p_playback_url, const String p_local_path);
+	/**
+	 * Get the cache file being written at `p_local_path`, creating it if nobody is writing it.
+	 */
+	std::shared_ptr<CacheFile> open_cache_file(const String p_local_path);
+
+	void _thread_backfill_cache(const String p_playback_url, const std::shared_ptr<CacheFile> p_file);
+
+	/**
+	 * Download the bytes of `p_file` that playback did not, in the background.
+	 */
+	void backfill_cache(const String p_playback_url, const std::shared_ptr<CacheFile> p_file);
 
 	YouTube();
 	virtual ~YouTube();
@@ -143,30 +204,77 @@ public:
 
 class Player : public audio::Decoder {
 	const String id;
+	const webm::PrefetchPolicy prefetch_policy;
+	const FormatPolicy format_policy;
+	const webm::PcmCachePolicy pcm_cache_policy;
 	const String local_path = String("user://youtube_cache/{0}.webm").format(varray(id));
 
 	bool terminate_thread = false;
 	std::thread thread;
 
+	String playback_url;
+	std::shared_ptr<CacheFile> cache_file;
+
+	// Whether playback moved to a lower bitrate rendition. The one in the disk cache is then not worth completing on a
+	// link that could not sustain it. Only written by the thread.
+	bool switched_down = false;
+
+	// Wakes the thread up once playback started, when the loaded audio runs low or a switch needs attention. Declared
+	// before the renditions, as their decoders call into it until they are deleted.
+	std::mutex wake_mutex;
+	std::condition_variable wake_condition;
+	std::atomic<bool> wake{ false };
+
 	struct Playback {
 		bool ready = false;
 		double start_pos = 0.0;
 		ebml::Stream *stream = nullptr;
 		webm::Decoder *decoder = nullptr;
 
-		~Playback() {
+		void clear() {
 			if (decoder != nullptr) {
 				delete decoder;
+				decoder = nullptr;
 			}
 			if (stream != nullptr) {
 				delete stream;
+				stream = nullptr;
 			}
 		}
+
+		~Playback() {
+			clear();
+		}
 	} playback;
 
+	// Lower bitrate rendition prepared by the thread. `sample` swaps it with `playback` once playback reaches
+	// `switch_time`, after which the thread deletes what was swapped out. Swapping happens under `switch_mutex`, which
+	// the methods called outside of the audio thread hold.
+	mutable std::mutex switch_mutex;
+	Playback next;
+	std::atomic<bool> has_next{ false };
+	std::atomic<bool> switched{ false };
+	std::atomic<double> switch_time{ 0.0 };
+
 protected:
+	/**
+	 * @param[in] p_formats Opus renditions, from the lowest bitrate to the highest.
+	 * @returns The index of the rendition to play according to `format_policy`.
+	 */
+	uint64_t _select_format(const std::vector<Variant> &p_formats) const;
+
+	/**
+	 * Start playback, then keep watching it while a lower bitrate rendition could be switched to. Once the loaded
+	 * clusters run low and the throughput no longer sustains the current rendition, a lower bitrate one is prepared for
+	 * `sample` to switch to.
+	 */
 	void _thread_func();
 
+	/**
+	 * Wake the thread up. Waits for a lock, so the audio thread only tries it in `sample`.
+	 */
+	void _wake_thread();
+
 public:
 	virtual double get_sample_rate() const;
 	virtual double get_duration() const;
@@ -174,7 +282,7 @@ public:
 	virtual void seek(const double p_time);
 	virtual void sample(audio::AudioFrame *const p_buffer, const uint64_t p_frames, bool &r_active, bool &r_buffering);
 
-	Player(const String p_id);
+	Player(const String p_id, const webm::PrefetchPolicy &p_prefetch_policy = webm::PrefetchPolicy(), const FormatPolicy &p_format_policy = FormatPolicy(), const webm::PcmCachePolicy &p_pcm_cache_policy = webm::PcmCachePolicy());
 	virtual ~Player();
 };
 }; // namespace yt